@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+#include "debug.h"
+
+#define ARENA_ALIGN		sizeof(void *)
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+};
+
+void arena_init(struct arena *arena)
+{
+	arena->head = NULL;
+	arena->pos = arena->end = NULL;
+	arena->next_size = ARENA_MIN_BLOCK;
+	arena->used = arena->mapped = 0;
+}
+
+static int arena_grow(struct arena *arena, size_t size)
+{
+	size_t block_size = arena->next_size;
+	struct arena_block *block;
+
+	size += sizeof(struct arena_block);
+	/* oversized requests get a block of their own */
+	if (size > block_size)
+		block_size = (size + 4095) & ~(size_t)4095;
+	else if (arena->next_size < ARENA_MAX_BLOCK)
+		arena->next_size *= 2;
+
+	block = mmap(NULL, block_size, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (block == MAP_FAILED) {
+		debug("mmap %zu bytes failed", block_size);
+		return -1;
+	}
+
+	block->next = arena->head;
+	block->size = block_size;
+	arena->head = block;
+	arena->pos = (char *)(block + 1);
+	arena->end = (char *)block + block_size;
+	arena->mapped += block_size;
+
+	return 0;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	void *ptr;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if ((size_t)(arena->end - arena->pos) < size && arena_grow(arena, size) < 0)
+		return NULL;
+
+	ptr = arena->pos;
+	arena->pos += size;
+	arena->used += size;
+
+	return ptr;
+}
+
+/* @align is a power of two, blocks start page aligned */
+void *arena_alloc_align(struct arena *arena, size_t size, size_t align)
+{
+	size_t pad = -(uintptr_t)arena->pos & (align - 1);
+
+	if ((size_t)(arena->end - arena->pos) < pad + size) {
+		if (arena_grow(arena, size + align) < 0)
+			return NULL;
+		pad = -(uintptr_t)arena->pos & (align - 1);
+	}
+
+	arena->pos += pad;
+	arena->used += pad;
+	return arena_alloc(arena, size);
+}
+
+char *arena_strndup(struct arena *arena, const char *str, size_t len)
+{
+	char *dup;
+
+	if (!(dup = arena_alloc(arena, len + 1)))
+		return NULL;
+
+	memcpy(dup, str, len);
+	dup[len] = '\0';
+
+	return dup;
+}
+
+char *arena_strdup(struct arena *arena, const char *str)
+{
+	return arena_strndup(arena, str, strlen(str));
+}
+
+void arena_free(struct arena *arena)
+{
+	struct arena_block *block, *next;
+
+	for (block = arena->head; block; block = next) {
+		next = block->next;
+		munmap(block, block->size);
+	}
+
+	arena_init(arena);
+}
@@ -0,0 +1,32 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+/* first block size, later blocks double up to ARENA_MAX_BLOCK */
+#define ARENA_MIN_BLOCK		(64 * 1024)
+#define ARENA_MAX_BLOCK		(4 * 1024 * 1024)
+
+struct arena_block;
+
+/*
+ * bump pointer allocator: memory is only given back all at once by
+ * arena_free(), blocks come straight from mmap.
+ */
+struct arena {
+	struct arena_block *head;
+	char *pos;
+	char *end;
+	size_t next_size;
+	size_t used;		/* bytes handed out */
+	size_t mapped;		/* bytes mapped */
+};
+
+void arena_init(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_alloc_align(struct arena *arena, size_t size, size_t align);
+char *arena_strdup(struct arena *arena, const char *str);
+char *arena_strndup(struct arena *arena, const char *str, size_t len);
+void arena_free(struct arena *arena);
+
+#endif /* _ARENA_H_ */
@@ -0,0 +1,408 @@
+/*
+ * config micro benchmarks: load, lookup, set and save over generated
+ * configs of growing size, plus the raw hash table paths.
+ *
+ * One JSON object per result goes to stdout (or -o file), a table for
+ * humans to stderr. Allocations are counted by wrapping malloc() and
+ * friends; the arenas come from mmap() and do not show up there, their
+ * footprint is in the RSS each op adds, read from /proc/self/statm before
+ * and after it. So are the pages load_mmap copies on write when it
+ * terminates names and values in the file's mapping. A load replacing
+ * the previous one frees that, so its delta can be negative.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "hash.h"
+#include "config.h"
+
+#define BENCH_LOOKUPS	1000000
+#define BENCH_SETS		100000
+#define BENCH_BATCH		40		/* keys a request reads at its start */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long nr_allocs;
+static unsigned long alloc_bytes;
+
+void *malloc(size_t size)
+{
+	__atomic_fetch_add(&nr_allocs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	__atomic_fetch_add(&nr_allocs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&alloc_bytes, nmemb * size, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__atomic_fetch_add(&nr_allocs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+/* key length distributions */
+enum { KEYS_SHORT, KEYS_LONG, KEYS_MIXED, NR_KEYLENS };
+static const char *const keylen_names[] = { "short", "long", "mixed" };
+
+struct bench_case {
+	long n;
+	int keylen;
+	int quoted;
+	char **keys;		/* n existing keys, then n missing ones */
+	char *path;
+};
+
+struct measure {
+	double t0;
+	unsigned long allocs;
+	unsigned long bytes;
+	long rss_kb;
+};
+
+static FILE *out;
+static uint64_t rng_state = 0x2545f4914f6cdd1dULL;
+
+static uint64_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* resident now, -1 without /proc; its stdio allocations are not counted */
+static long rss_kb(void)
+{
+	FILE *fp;
+	long size, resident = -1;
+
+	if (!(fp = fopen("/proc/self/statm", "r")))
+		return -1;
+	if (fscanf(fp, "%ld %ld", &size, &resident) != 2)
+		resident = -1;
+	fclose(fp);
+
+	return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void start(struct measure *m)
+{
+	m->rss_kb = rss_kb();
+	m->allocs = __atomic_load_n(&nr_allocs, __ATOMIC_RELAXED);
+	m->bytes = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED);
+	m->t0 = now();
+}
+
+static void stop(struct measure *m, const struct bench_case *bc,
+				 const char *op, long ops)
+{
+	double secs = now() - m->t0;
+	unsigned long allocs = __atomic_load_n(&nr_allocs, __ATOMIC_RELAXED) - m->allocs;
+	unsigned long bytes = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED) - m->bytes;
+	double ns = secs * 1e9 / ops;
+	long rss = rss_kb(), delta = rss < 0 || m->rss_kb < 0 ? 0 : rss - m->rss_kb;
+
+	fprintf(out, "{\"op\":\"%s\",\"keys\":%ld,\"keylen\":\"%s\",\"values\":\"%s\","
+			"\"ops\":%ld,\"ns_per_op\":%.2f,\"ops_per_sec\":%.0f,"
+			"\"allocs\":%lu,\"alloc_bytes\":%lu,\"rss_kb\":%ld,\"rss_delta_kb\":%ld}\n",
+			op, bc->n, keylen_names[bc->keylen], bc->quoted ? "quoted" : "plain",
+			ops, ns, ops / secs, allocs, bytes, rss, delta);
+
+	fprintf(stderr, "%-14s %9ld %-6s %-6s %10.1f ns/op %12.0f op/s %10lu allocs %+8ld KB\n",
+			op, bc->n, keylen_names[bc->keylen], bc->quoted ? "quoted" : "plain",
+			ns, ops / secs, allocs, delta);
+}
+
+static int key_len(int keylen)
+{
+	switch (keylen) {
+	case KEYS_SHORT:
+		return 8 + rng() % 5;
+	case KEYS_LONG:
+		return 48 + rng() % 17;
+	default:
+		/* mostly short, some very long */
+		return (rng() % 4) ? 4 + rng() % 16 : 16 + rng() % 113;
+	}
+}
+
+/* unique thanks to the index in front, padded to the drawn length */
+static char *make_key(long i, int len)
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz_.";
+	char *key = malloc(len + 24);
+	int n;
+
+	n = sprintf(key, "k%lx_", i);
+	while (n < len)
+		key[n++] = chars[rng() % (sizeof(chars) - 1)];
+	key[n] = '\0';
+
+	return key;
+}
+
+static void write_value(FILE *fp, int quoted)
+{
+	int words = quoted ? 2 + rng() % 3 : 1, len, i;
+
+	if (quoted)
+		fputc('"', fp);
+	while (words--) {
+		len = 3 + rng() % 8;
+		for (i = 0; i < len; i++)
+			fputc('a' + rng() % 26, fp);
+		if (words)
+			fputc(' ', fp);
+	}
+	if (quoted)
+		fputc('"', fp);
+	fputc('\n', fp);
+}
+
+static int gen_case(struct bench_case *bc)
+{
+	char path[] = "/tmp/config-bench-XXXXXX";
+	FILE *fp;
+	long i;
+	int fd;
+
+	if ((fd = mkstemp(path)) < 0 || !(fp = fdopen(fd, "w")))
+		return -1;
+
+	bc->path = strdup(path);
+	bc->keys = malloc(sizeof(char *) * bc->n * 2);
+	for (i = 0; i < bc->n * 2; i++)
+		bc->keys[i] = make_key(i, key_len(bc->keylen));
+
+	fprintf(fp, "# %ld keys\n", bc->n);
+	for (i = 0; i < bc->n; i++) {
+		fprintf(fp, "%s = ", bc->keys[i]);
+		write_value(fp, bc->quoted);
+	}
+
+	return fclose(fp);
+}
+
+static void free_case(struct bench_case *bc)
+{
+	long i;
+
+	unlink(bc->path);
+	free(bc->path);
+	for (i = 0; i < bc->n * 2; i++)
+		free(bc->keys[i]);
+	free(bc->keys);
+}
+
+/* the rest of the case is skipped, its numbers would mean nothing */
+static int bench_fail(config_t *cfg, const struct bench_case *bc, const char *op)
+{
+	fprintf(stderr, "bench: %s failed for %ld %s %s keys\n", op, bc->n,
+			keylen_names[bc->keylen], bc->quoted ? "quoted" : "plain");
+	config_close(cfg);
+	return -1;
+}
+
+static int bench_config(struct bench_case *bc)
+{
+	struct measure m;
+	config_t *cfg;
+	char save_path[] = "/tmp/config-bench-save-XXXXXX";
+	const char *batch[BENCH_BATCH];
+	char *values[BENCH_BATCH];
+	long i, j, ops, hits = 0;
+	int fd, ret;
+
+	cfg = config_open();
+
+	start(&m);
+	if (cfg_load(cfg, bc->path) < 0)
+		return bench_fail(cfg, bc, "load");
+	stop(&m, bc, "load", bc->n);
+
+	start(&m);
+	if (cfg_load_mmap(cfg, bc->path) < 0)
+		return bench_fail(cfg, bc, "load_mmap");
+	stop(&m, bc, "load_mmap", bc->n);
+
+	start(&m);
+	if (cfg_load_parallel(cfg, bc->path, 0) < 0)
+		return bench_fail(cfg, bc, "load_parallel");
+	stop(&m, bc, "load_parallel", bc->n);
+
+	ops = BENCH_LOOKUPS;
+	start(&m);
+	for (i = 0; i < ops; i++)
+		hits += cfg_get_value(cfg, bc->keys[rng() % bc->n]) != NULL;
+	stop(&m, bc, "get_hit", ops);
+
+	start(&m);
+	for (i = 0; i < ops; i++)
+		hits += cfg_get_value(cfg, bc->keys[bc->n + rng() % bc->n]) != NULL;
+	stop(&m, bc, "get_miss", ops);
+
+	if (hits != ops)
+		fprintf(stderr, "bench: %ld hits for %ld lookups\n", hits, ops);
+
+	/* the same batches of keys, one call each against one cfg_get_values() */
+	ops = BENCH_LOOKUPS / BENCH_BATCH * BENCH_BATCH;
+	hits = 0;
+	start(&m);
+	for (i = 0; i < ops; i += BENCH_BATCH) {
+		for (j = 0; j < BENCH_BATCH; j++)
+			batch[j] = bc->keys[rng() % bc->n];
+		for (j = 0; j < BENCH_BATCH; j++)
+			hits += cfg_get_value(cfg, batch[j]) != NULL;
+	}
+	stop(&m, bc, "get_seq", ops);
+
+	start(&m);
+	for (i = 0; i < ops; i += BENCH_BATCH) {
+		for (j = 0; j < BENCH_BATCH; j++)
+			batch[j] = bc->keys[rng() % bc->n];
+		hits += cfg_get_values(cfg, batch, BENCH_BATCH, values);
+	}
+	stop(&m, bc, "get_values", ops);
+
+	if (hits != ops * 2)
+		fprintf(stderr, "bench: %ld hits for %ld lookups\n", hits, ops * 2);
+
+	ops = BENCH_SETS;
+	start(&m);
+	for (i = 0; i < ops; i++) {
+		if (cfg_set_value(cfg, bc->keys[rng() % bc->n], "changed") < 0)
+			return bench_fail(cfg, bc, "set_existing");
+	}
+	stop(&m, bc, "set_existing", ops);
+
+	/* keys the file does not have, each one grows the table */
+	ops = bc->n < BENCH_SETS ? bc->n : BENCH_SETS;
+	start(&m);
+	for (i = 0; i < ops; i++) {
+		if (cfg_set_value(cfg, bc->keys[bc->n + i], "new") < 0)
+			return bench_fail(cfg, bc, "set_new");
+	}
+	stop(&m, bc, "set_new", ops);
+
+	if ((fd = mkstemp(save_path)) < 0)
+		return bench_fail(cfg, bc, "mkstemp");
+	close(fd);
+	start(&m);
+	ret = cfg_save(cfg, save_path);
+	unlink(save_path);
+	if (ret < 0)
+		return bench_fail(cfg, bc, "save");
+	stop(&m, bc, "save", bc->n);
+
+	config_close(cfg);
+	return 0;
+}
+
+static void bench_hash(struct bench_case *bc, int flags, const char *add_op,
+					   const char *find_op)
+{
+	struct hash_table *table;
+	struct hash_node *node;
+	struct measure m;
+	long i, ops;
+
+	table = hash_init(37, HASH_KEY_TYPE_STR, flags);
+
+	start(&m);
+	for (i = 0; i < bc->n; i++)
+		hash_add(table, bc->keys[i], bc->keys[i]);
+	stop(&m, bc, add_op, bc->n);
+
+	ops = BENCH_LOOKUPS;
+	start(&m);
+	for (i = 0; i < ops; i++)
+		hash_find(table, bc->keys[rng() % (bc->n * 2)], &node, 1);
+	stop(&m, bc, find_op, ops);
+
+	hash_free(table);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n max_keys] [-o file]\n"
+			"  runs 1e2 keys up to max_keys (default 1e6, at most 1e7) in\n"
+			"  powers of ten, for each key length mix, plain and quoted values\n",
+			prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_case bc;
+	long max = 1000000, n;
+	int opt, failed = 0;
+
+	out = stdout;
+
+	while ((opt = getopt(argc, argv, "n:o:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			max = (long)strtod(optarg, NULL);
+			break;
+		case 'o':
+			if (!(out = fopen(optarg, "w"))) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (max > 10000000)
+		max = 10000000;
+
+	for (n = 100; n <= max; n *= 10) {
+		for (bc.keylen = 0; bc.keylen < NR_KEYLENS; bc.keylen++) {
+			for (bc.quoted = 0; bc.quoted < 2; bc.quoted++) {
+				bc.n = n;
+				if (gen_case(&bc) < 0) {
+					perror("bench: generating config");
+					return 1;
+				}
+				if (bench_config(&bc) < 0)
+					failed = 1;
+				bench_hash(&bc, 0, "hash_add", "hash_find");
+				bench_hash(&bc, HASH_OPEN_ADDRESSING, "hash_add_oa", "hash_find_oa");
+				free_case(&bc);
+				fflush(out);
+			}
+		}
+	}
+
+	if (out != stdout)
+		fclose(out);
+
+	return failed;
+}
@@ -0,0 +1,319 @@
+/*
+ * Read scalability: N threads doing cfg_get_value() against one writer
+ * that keeps calling cfg_set_value() and reloading the file, for N from
+ * 1 up to the number of cores.
+ *
+ * Every BENCH_SAMPLE-th lookup is timed on its own, the latencies go into
+ * a log-linear histogram per thread. One JSON object per thread count
+ * goes to stdout (or -o file), a table for humans to stderr.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "config.h"
+
+#define BENCH_SAMPLE	8
+/* histogram: 16 linear sub-buckets per power of two of nanoseconds */
+#define HIST_SUB_BITS	4
+#define HIST_SUB		(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	(64 * HIST_SUB)
+
+struct reader {
+	pthread_t thread;
+	uint64_t rng;
+	unsigned long ops;
+	unsigned long hits;
+	unsigned long hist[HIST_BUCKETS];
+} __attribute__((aligned(64)));
+
+static config_t *cfg;
+static char **keys;			/* nkeys existing keys, then nkeys missing ones */
+static long nkeys;
+static double hit_ratio = 0.9;
+static int run;				/* readers and writer loop while set */
+static int go;				/* released all at once */
+static unsigned long writer_sets;
+static unsigned long writer_reloads;
+static char conf_path[] = "/tmp/config-bench-mt-XXXXXX";
+
+static uint64_t rng(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int hist_bucket(uint64_t ns)
+{
+	int msb;
+
+	if (ns < HIST_SUB)
+		return ns;
+
+	msb = 63 - __builtin_clzll(ns);
+	return (msb - HIST_SUB_BITS + 1) * HIST_SUB +
+		((ns >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* the lowest latency that falls into bucket @b */
+static uint64_t hist_value(int b)
+{
+	int shift;
+
+	if (b < HIST_SUB)
+		return b;
+
+	shift = b / HIST_SUB - 1;
+	return (uint64_t)(HIST_SUB + b % HIST_SUB) << shift;
+}
+
+static uint64_t hist_percentile(const unsigned long *hist, double p)
+{
+	unsigned long total = 0, seen = 0;
+	int b;
+
+	for (b = 0; b < HIST_BUCKETS; b++)
+		total += hist[b];
+
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		seen += hist[b];
+		if (seen && seen >= total * p)
+			return hist_value(b);
+	}
+
+	return 0;
+}
+
+static const char *pick_key(uint64_t *s)
+{
+	uint64_t r = rng(s);
+
+	if ((double)(r >> 11) / (1ULL << 53) < hit_ratio)
+		return keys[rng(s) % nkeys];
+
+	return keys[nkeys + rng(s) % nkeys];
+}
+
+static void *reader_main(void *arg)
+{
+	struct reader *r = arg;
+	uint64_t t0;
+	unsigned long i;
+
+	while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+		;
+
+	for (i = 0; __atomic_load_n(&run, __ATOMIC_RELAXED); i++) {
+		const char *key = pick_key(&r->rng);
+
+		if (i % BENCH_SAMPLE == 0) {
+			t0 = now_ns();
+			r->hits += cfg_get_value(cfg, key) != NULL;
+			r->hist[hist_bucket(now_ns() - t0)]++;
+		} else {
+			r->hits += cfg_get_value(cfg, key) != NULL;
+		}
+	}
+	r->ops = i;
+
+	return NULL;
+}
+
+/* a set per millisecond or so, a full reload every 100ms */
+static void *writer_main(void *arg)
+{
+	uint64_t s = 88172645463325252ULL, last_reload = now_ns();
+	char value[32];
+
+	while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+		;
+
+	while (__atomic_load_n(&run, __ATOMIC_RELAXED)) {
+		snprintf(value, sizeof(value), "v%lu", (unsigned long)(rng(&s) % 1000));
+		cfg_set_value(cfg, keys[rng(&s) % nkeys], value);
+		writer_sets++;
+
+		if (now_ns() - last_reload > 100000000ULL) {
+			cfg_load_mmap(cfg, conf_path);
+			writer_reloads++;
+			last_reload = now_ns();
+		}
+		usleep(1000);
+	}
+
+	return NULL;
+}
+
+static int gen_config(void)
+{
+	FILE *fp;
+	long i;
+	int fd;
+
+	if ((fd = mkstemp(conf_path)) < 0 || !(fp = fdopen(fd, "w")))
+		return -1;
+
+	keys = malloc(sizeof(char *) * nkeys * 2);
+	for (i = 0; i < nkeys * 2; i++) {
+		keys[i] = malloc(32);
+		snprintf(keys[i], 32, "bench.key.%lx", i);
+	}
+
+	for (i = 0; i < nkeys; i++)
+		fprintf(fp, "%s = value%ld\n", keys[i], i);
+
+	return fclose(fp);
+}
+
+static void run_step(FILE *out, int nthreads, double secs, struct reader *readers)
+{
+	static unsigned long hist[HIST_BUCKETS];
+	pthread_t writer;
+	unsigned long ops = 0, hits = 0, min_ops = ~0UL, max_ops = 0;
+	uint64_t t0, elapsed;
+	int i, b;
+
+	memset(readers, 0, sizeof(struct reader) * nthreads);
+	memset(hist, 0, sizeof(hist));
+	writer_sets = writer_reloads = 0;
+	run = 1;
+	go = 0;
+
+	for (i = 0; i < nthreads; i++) {
+		readers[i].rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+		pthread_create(&readers[i].thread, NULL, reader_main, &readers[i]);
+	}
+	pthread_create(&writer, NULL, writer_main, NULL);
+
+	t0 = now_ns();
+	__atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+	usleep(secs * 1e6);
+	__atomic_store_n(&run, 0, __ATOMIC_RELAXED);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(readers[i].thread, NULL);
+	elapsed = now_ns() - t0;
+	pthread_join(writer, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		ops += readers[i].ops;
+		hits += readers[i].hits;
+		if (readers[i].ops < min_ops)
+			min_ops = readers[i].ops;
+		if (readers[i].ops > max_ops)
+			max_ops = readers[i].ops;
+		for (b = 0; b < HIST_BUCKETS; b++)
+			hist[b] += readers[i].hist[b];
+	}
+
+	fprintf(out, "{\"threads\":%d,\"keys\":%ld,\"hit_ratio\":%.3f,\"seconds\":%.3f,"
+			"\"ops\":%lu,\"ops_per_sec\":%.0f,\"ops_per_sec_per_thread\":%.0f,"
+			"\"min_thread_ops_per_sec\":%.0f,\"max_thread_ops_per_sec\":%.0f,"
+			"\"hits\":%lu,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+			"\"writer_sets\":%lu,\"writer_reloads\":%lu}\n",
+			nthreads, nkeys, hit_ratio, elapsed * 1e-9,
+			ops, ops / (elapsed * 1e-9), ops / (elapsed * 1e-9) / nthreads,
+			min_ops / (elapsed * 1e-9), max_ops / (elapsed * 1e-9), hits,
+			(unsigned long long)hist_percentile(hist, 0.50),
+			(unsigned long long)hist_percentile(hist, 0.99),
+			(unsigned long long)hist_percentile(hist, 0.999),
+			writer_sets, writer_reloads);
+	fflush(out);
+
+	fprintf(stderr, "%3d threads %12.0f op/s %12.0f op/s/thread  p50 %6llu  p99 %6llu  p999 %7llu ns  (%lu sets, %lu reloads)\n",
+			nthreads, ops / (elapsed * 1e-9), ops / (elapsed * 1e-9) / nthreads,
+			(unsigned long long)hist_percentile(hist, 0.50),
+			(unsigned long long)hist_percentile(hist, 0.99),
+			(unsigned long long)hist_percentile(hist, 0.999),
+			writer_sets, writer_reloads);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n keys] [-r hit_ratio] [-t max_threads] [-s seconds] [-o file]\n"
+			"  defaults: 1e5 keys, 0.9 hits, all cores, 2 seconds per step\n",
+			prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct reader *readers;
+	FILE *out = stdout;
+	double secs = 2;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int max_threads = cores > 0 ? cores : 1, n, opt;
+
+	nkeys = 100000;
+
+	while ((opt = getopt(argc, argv, "n:r:t:s:o:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nkeys = (long)strtod(optarg, NULL);
+			break;
+		case 'r':
+			hit_ratio = strtod(optarg, NULL);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			secs = strtod(optarg, NULL);
+			break;
+		case 'o':
+			if (!(out = fopen(optarg, "w"))) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (nkeys < 1 || max_threads < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (gen_config() < 0) {
+		perror("bench_mt: generating config");
+		return 1;
+	}
+
+	cfg = config_open();
+	if (cfg_load_mmap(cfg, conf_path) < 0) {
+		fprintf(stderr, "bench_mt: cannot load %s\n", conf_path);
+		unlink(conf_path);
+		return 1;
+	}
+
+	if (posix_memalign((void **)&readers, 64, sizeof(struct reader) * max_threads))
+		return 1;
+
+	/* 1, 2, 4, ... and the core count itself */
+	for (n = 1; n <= max_threads; n = (n * 2 > max_threads && n != max_threads) ?
+		 max_threads : n * 2)
+		run_step(out, n, secs, readers);
+
+	config_close(cfg);
+	unlink(conf_path);
+	free(readers);
+	if (out != stdout)
+		fclose(out);
+
+	return 0;
+}
@@ -1,276 +1,3802 @@
+/* memrchr() */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/sysinfo.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "hash.h"
+#include "scan.h"
+#include "image.h"
+#include "mph.h"
+#include "epoch.h"
+#include "watch.h"
+#include "file.h"
 #include "debug.h"
 #include "config.h"
 
 #define END_LINE(c)			(c == '\n' || c == '\0')
 #define HASH_NUM_BUCKETS	37
 
+/* cfg->source, which loader read cfg->path */
+#define SOURCE_NONE			0
+#define SOURCE_TEXT			1
+#define SOURCE_MMAP			2
+#define SOURCE_COMPILED		3
+#define SOURCE_PARALLEL		4
+
+/* opt->flags */
+#define OPT_VALUE_HEAP		0x01	/* value was malloc()ed by cfg_set_value */
+#define OPT_DIRTY			0x02	/* set since the last cfg_save(), in data->dirty */
+#define OPT_MODIFIED		0x04	/* differs from the file, in data->modified */
+#define OPT_VALUE_INTERN	0x08	/* value is an intern_str in data->strings */
+
+/* opt_cache.type, CACHE_ERR is or'ed in when the value did not parse */
+#define CACHE_INT			1
+#define CACHE_DOUBLE		2
+#define CACHE_BOOL			3
+#define CACHE_DURATION		4
+#define CACHE_ERR			0x100
+
+/*
+ * The last typed value parsed from an opt's value string. Any reader may
+ * fill it, so it is a seqlock: seq is odd while a fill is in progress and
+ * readers retry nothing, they just parse again. It only counts while src
+ * is still the opt's value.
+ */
+struct opt_cache {
+	unsigned seq;
+	int type;
+	const char *src;
+	int64_t bits;		/* long, int64_t or the bits of a double */
+};
+
+/* bytes of name and value kept in the opt itself, see alloc_opt() */
+#define OPT_INLINE			23
+
+/* alloc_opt() @copy bits, only strings copied anyway can go inline */
+#define COPY_NAME			0x01
+#define COPY_VALUE			0x02
+#define COPY_ALL			(COPY_NAME | COPY_VALUE)
+
+/*
+ * One 64 byte record per key, cache line aligned, with the table's node
+ * in it: its key is the name and its value the value string, so a lookup
+ * of a short copied name with a short value touches this one line. What only
+ * saves and typed getters need is in the data's cold table, see cold_of().
+ */
 typedef struct {
+	struct hash_node node;	/* value swapped atomically by cfg_set_value() */
+	int section;		/* config_section id, the key is the leaf; 0 for top level */
+	unsigned cold;		/* index + 1 in data->cold, 0 if it has none yet */
+	unsigned char flags;
+	char inline_buf[OPT_INLINE];	/* "name\0value\0", as far as they fit */
+} __attribute__((aligned(64))) config_opt_t;
+
+/* the opt of a node in data->table */
+#define opt_of(pos)			container_of(pos, config_opt_t, node)
+
+/* the rest of an opt, made on first use */
+struct opt_cold {
+	size_t span_off;
+	unsigned span_len;	/* the line in the loaded file, 0 if none */
+	struct opt_cache cache;
+};
+
+/* data->cold[k] holds COLD_CHUNK << k records, so they never move */
+#define COLD_SHIFT			6
+#define COLD_CHUNK			(1 << COLD_SHIFT)
+#define COLD_CHUNKS			26
+
+#define opt_name(opt)		((char *)(opt)->node.key)
+
+/* opts in the order they were added */
+struct opt_list {
+	config_opt_t **opts;
+	size_t n;
+	size_t cap;
+};
+
+/*
+ * A "[name]" header and the keys under it. Their opts are named by the
+ * leaf alone and only kept here, with the section's id: the prefix is
+ * stored once per section, not once per key. A flat "name.leaf" lookup
+ * misses the data's table and finds them through section_get_opt().
+ */
+struct config_section {
+	char *name;
+	size_t name_len;
+	int id;						/* index + 1 in data->section_list */
+	/* leaf -> opt; once published, both grow by replacement, see section_grow_live() */
+	struct hash_table *keys;
+	struct opt_list opts;		/* in file order */
+};
+
+/* what a config_key_t stands for in one config_data */
+struct key_slot {
+	config_opt_t *opt;
+	const char *value;	/* compiled images, there is no opt */
+};
+
+/* indexed by config_key_t, one slot per name cfg_resolve() has seen */
+struct key_table {
+	int n;
+	struct key_slot slots[];
+};
+
+/*
+ * Everything a load produces. Once published in cfg->data, readers walk
+ * it without any lock while cfg_set_value() changes it under cfg->lock,
+ * only ever adding:
+ *  - a value is replaced with one atomic exchange of opt->node.value;
+ *  - a new key's opt, section entry and resolved key slot are filled in
+ *    first and made reachable by a release store of the one pointer or
+ *    count that leads to them, which readers load with acquire;
+ *  - nothing reachable is unlinked, and the table never resizes: when it
+ *    is full, a copy with room for as many keys again is published like
+ *    a reload. Section tables and arrays are swapped for bigger copies
+ *    and the old ones retired, see section_grow_live().
+ */
+struct config_data {
+	struct hash_table *table;
+	/* opts whose value is OPT_VALUE_HEAP, data_free() skips the walk if 0 */
+	int heap_values;
+	/* the content hash of the file as it was read, see loaded_hash() */
+	uint64_t file_hash;
+	/* cfg_load_mmap(): names and values point into this mapping */
+	char *map;
+	size_t map_len;
+	/* cfg_load_compiled(): lookups go to the image, there is no table */
+	struct image image;
+	/* cfg_freeze(): lookups go to the mph, the table is kept for unfreezing */
+	struct mph *mph;
+	/* cfg_load_parallel(): where each worker put its opts */
+	struct arena *arenas;
+	int narenas;
+	/* resolved config_key_t, filled in by publish() and cfg_resolve() */
+	struct key_table *keys;
+	/* OPT_DIRTY opts, what a journal save appends; under cfg->lock */
+	struct opt_list dirty;
+	/* OPT_MODIFIED opts, what a cfg_set_preserve() save patches */
+	struct opt_list modified;
+	/* cfg_set_preserve(): the loaded file, read-only, spans point here */
+	char *src;
+	size_t src_len;
+	/* cfg_set_intern(): value -> struct intern_str, NULL when off */
+	struct hash_table *strings;
+	/* some top level name has a '.', see line_opt_find() */
+	int dotted;
+	/* "[name]" sections, interned by name; NULL until the first one */
+	struct hash_table *sections;
+	/* bit n: a section name has n dots, the top bit for that many or more */
+	unsigned long section_dots;
+	struct config_section **section_list;
+	int nsections;
+	/* opt->cold records, filled in by readers too; see cold_of() */
+	struct opt_cold *cold[COLD_CHUNKS];
+	unsigned ncold;
+	/* keep the span of each line, for a cfg_set_preserve() save */
+	int spans;
+};
+
+struct config {
+	char delim;
+	char comment;
+
+	/* read with __atomic_load_n(), replaced as a whole by publish() */
+	struct config_data *data;
+	/* serializes writers, readers never take it */
+	pthread_mutex_t lock;
+
+	/* names behind config_key_t, kept across loads; under lock */
+	char **key_names;
+	int nkeys;
+
+	/* the last successful load, what the watcher reloads; under lock */
+	char *path;
+	int source;
+	int source_arg;		/* cfg_load_compiled() verify, cfg_load_parallel() nthreads */
+	/* cfg_freeze() until cfg_unfreeze(), loads are frozen too; under lock */
+	int frozen;
+
+	/* cfg_watch() */
+	struct watch *watch;
+	config_reload_cb reload_cb;
+	void *reload_arg;
+	pthread_t watch_thread;
+	int watch_threaded;
+	int watch_stop;
+
+	/* cfg_set_journal(), 0 when saves rewrite the whole file */
+	int journal_ratio;
+	/* cfg_set_preserve() */
+	int preserve;
+	/* cfg_set_intern() */
+	int intern;
+};
+
+#define CONFIG_INIT { .delim = '=', .comment = '#', .lock = PTHREAD_MUTEX_INITIALIZER }
+
+/* the instance behind the config_*() calls that take no handle */
+static struct config default_config = CONFIG_INIT;
+
+/*
+ * One copy of a value shared by every opt that has it. Loads put them in
+ * the table's arena, where they stay until the data is freed, even at 0
+ * refs. cfg_set_value() mallocs new ones, those go away with the last
+ * reference.
+ */
+struct intern_str {
+	unsigned refs;
+	unsigned heap;
+	char str[];
+};
+
+#define intern_of(s)	((struct intern_str *)((s) - offsetof(struct intern_str, str)))
+
+/*
+ * a tokenized "name = value" line, both are NUL terminated inside the
+ * line itself unless value_unterminated is set.
+ */
+struct line_tok {
 	char *name;
 	char *value;
-} config_opt_t;
+	size_t value_len;
+	int value_unterminated;
+};
+
+/* @size: buckets of the table */
+static struct config_data *data_new_size(int size)
+{
+	struct config_data *d;
+
+	if (!(d = calloc(1, sizeof(struct config_data))))
+		return NULL;
+
+	if (!(d->table = hash_init(size, HASH_KEY_TYPE_STR, HASH_ARENA))) {
+		free(d);
+		return NULL;
+	}
+
+	return d;
+}
+
+static struct config_data *data_new(void)
+{
+	return data_new_size(HASH_NUM_BUCKETS);
+}
+
+static void free_mph(void *mph)
+{
+	mph_free(mph);
+	free(mph);
+}
+
+static void free_table(void *table)
+{
+	hash_free(table);
+}
+
+static void data_free(void *arg)
+{
+	struct config_data *d = arg;
+	struct config_section *sec;
+	struct hash_iter iter;
+	struct hash_node *pos;
+	size_t j;
+	int i;
+
+	if (d->image.map)
+		image_close(&d->image);
+
+	if (d->mph)
+		free_mph(d->mph);
+
+	free(d->keys);
+	free(d->dirty.opts);
+	free(d->modified.opts);
+
+	if (d->strings) {
+		hash_for_each(d->strings, &iter, pos) {
+			if (((struct intern_str *)pos->value)->heap)
+				free(pos->value);
+		}
+		hash_free(d->strings);
+	}
+
+	for (i = 0; i < d->nsections; i++) {
+		sec = d->section_list[i];
+		for (j = 0; d->heap_values && j < sec->opts.n; j++) {
+			if (sec->opts.opts[j]->flags & OPT_VALUE_HEAP)
+				free(sec->opts.opts[j]->node.value);
+		}
+		hash_free(sec->keys);
+		free(sec->opts.opts);
+	}
+	free(d->section_list);
+	if (d->sections)
+		hash_free(d->sections);
+
+	for (i = 0; i < d->narenas; i++)
+		arena_free(&d->arenas[i]);
+	free(d->arenas);
+
+	if (d->table && d->heap_values) {
+		hash_for_each(d->table, &iter, pos) {
+			if (opt_of(pos)->flags & OPT_VALUE_HEAP)
+				free(pos->value);
+		}
+	}
+
+	for (i = 0; i < COLD_CHUNKS; i++)
+		free(d->cold[i]);
 
-static char delim = '=';
-static char comment = '#';
+	/* everything else goes away with the arena and the mapping */
+	hash_free(d->table);
 
-static struct hash_table *config_table;
+	if (d->map)
+		munmap(d->map, d->map_len);
+	if (d->src)
+		munmap(d->src, d->src_len);
 
-static config_opt_t *new_config_opt(const char *name, const char *value)
+	free(d);
+}
+
+static config_opt_t *data_get_opt(struct config_data *d, const char *name);
+
+/* look every registered key name up in @d, called with cfg->lock held */
+static struct key_table *resolve_keys(config_t *cfg, struct config_data *d)
+{
+	struct key_table *kt;
+	struct key_slot *slot;
+	int i;
+
+	if (!(kt = malloc(sizeof(struct key_table) +
+					  sizeof(struct key_slot) * cfg->nkeys)))
+		return NULL;
+
+	kt->n = cfg->nkeys;
+	for (i = 0; i < kt->n; i++) {
+		slot = &kt->slots[i];
+		slot->opt = data_get_opt(d, cfg->key_names[i]);
+		slot->value = d->image.map ?
+			image_lookup(&d->image, cfg->key_names[i]) : NULL;
+	}
+
+	return kt;
+}
+
+/*
+ * Make @d (may be NULL) the current data with a single pointer swap, the
+ * previous one is freed once no reader can be looking at it any more.
+ * Called with cfg->lock held.
+ */
+static void publish(config_t *cfg, struct config_data *d)
+{
+	struct config_data *old;
+	int i;
+
+	if (d && d->table)
+		hash_rehash_finish(d->table);
+	for (i = 0; d && i < d->nsections; i++)
+		hash_rehash_finish(d->section_list[i]->keys);
+	if (d && d->sections)
+		hash_rehash_finish(d->sections);
+
+	/* without memory the keys read as missing until the next publish */
+	if (d)
+		d->keys = resolve_keys(cfg, d);
+
+	old = __atomic_exchange_n(&cfg->data, d, __ATOMIC_SEQ_CST);
+	if (old)
+		epoch_retire(data_free, old);
+}
+
+/*
+ * publish() data read from @filename, remembering how it was read. Data
+ * from elsewhere (@filename NULL) leaves nothing for the watcher.
+ */
+static int data_freeze(struct config_data *d);
+
+static void publish_file(config_t *cfg, struct config_data *d,
+						 const char *filename, int source, int arg)
+{
+	char *path = filename ? strdup(filename) : NULL;
+
+	pthread_mutex_lock(&cfg->lock);
+	/* frozen before readers see it, so it is never writable in between */
+	if (cfg->frozen && d && d->table && data_freeze(d) < 0)
+		debug("cannot freeze the new config of %s", filename ? filename : "-");
+	publish(cfg, d);
+	free(cfg->path);
+	cfg->path = path;
+	cfg->source = path ? source : SOURCE_NONE;
+	cfg->source_arg = arg;
+	/* the watcher picks up the new file and hash, see watch_sync() */
+	if (cfg->watch)
+		watch_wakeup(cfg->watch);
+	pthread_mutex_unlock(&cfg->lock);
+}
+
+/*
+ * opts live in the table's arena. A name, and then a value, with the
+ * @copy bit for it goes into opt->inline_buf if short enough and is
+ * copied to the arena otherwise. Without the bit it is referenced where
+ * it is, the cfg_load_mmap() mapping, which is not copied a second time
+ * just to save a cache miss. Only values replaced by cfg_set_value() are
+ * on the heap.
+ */
+static size_t inline_name_len(const char *name, int copy)
+{
+	size_t len = strlen(name) + 1;
+
+	return (copy & COPY_NAME) && len <= OPT_INLINE ? len : 0;
+}
+
+/* would alloc_opt() keep @value inline */
+static int value_is_inline(const char *name, const char *value, int copy)
+{
+	return (copy & COPY_VALUE) &&
+		strlen(value) + 1 <= OPT_INLINE - inline_name_len(name, copy);
+}
+
+static config_opt_t *alloc_opt(struct arena *arena, char *name,
+							   char *value, int copy)
 {
 	config_opt_t *opt;
+	size_t used = inline_name_len(name, copy), value_len = strlen(value) + 1;
 
-	if (!(opt = malloc(sizeof(config_opt_t))))
+	if (!(opt = arena_alloc_align(arena, sizeof(config_opt_t), 64)))
 		return NULL;
 
-	if (!(opt->name = strdup(name))) {
-		free(opt);
+	if (used) {
+		opt->node.key = memcpy(opt->inline_buf, name, used);
+	} else if (!(opt->node.key = (copy & COPY_NAME) ?
+				 arena_strdup(arena, name) : name)) {
 		return NULL;
 	}
 
-	if (!(opt->value = strdup(value))) {
-		free(opt->name);
-		free(opt);
+	if ((copy & COPY_VALUE) && value_len <= OPT_INLINE - used) {
+		opt->node.value = memcpy(opt->inline_buf + used, value, value_len);
+	} else if (!(opt->node.value = (copy & COPY_VALUE) ?
+				 arena_strdup(arena, value) : value)) {
 		return NULL;
 	}
 
+	opt->flags = 0;
+	opt->section = 0;
+	opt->cold = 0;
+
 	return opt;
 }
 
-static config_opt_t *config_add_opt(const char *name, const char *value)
+static int intern_init(struct config_data *d)
 {
-	config_opt_t *opt;
+	d->strings = hash_init(HASH_NUM_BUCKETS, HASH_KEY_TYPE_STR, HASH_ARENA);
+	return d->strings ? 0 : -1;
+}
+
+/*
+ * A reference to the shared copy of @value, made if there is none yet:
+ * in the arena, or with @heap on the heap. Writers only.
+ */
+static char *intern_get(struct config_data *d, const char *value, int heap)
+{
+	struct intern_str *s;
 	struct hash_node *node;
+	size_t len;
 
-	int n = hash_find(config_table, name, &node, 1);
+	if (hash_find(d->strings, value, &node, 1) == 1) {
+		s = node->value;
+		s->refs++;
+		return s->str;
+	}
 
-	if (n == 0) {
-		if (!(opt = new_config_opt(name, value)))
-			return NULL;
-		hash_add(config_table, opt->name, opt);
-	} else {
-		opt = node->value;
+	len = strlen(value) + 1;
+	s = heap ? malloc(sizeof(struct intern_str) + len) :
+		arena_alloc(hash_arena(d->table), sizeof(struct intern_str) + len);
+	if (!s)
+		return NULL;
+
+	s->refs = 1;
+	s->heap = heap;
+	memcpy(s->str, value, len);
+	if (hash_add(d->strings, s->str, s) < 0) {
+		if (heap)
+			free(s);
+		return NULL;
 	}
 
-	return opt;
+	return s->str;
 }
 
-static config_opt_t *config_get_opt(const char *name)
+/* drop a reference from intern_get(), readers may still see @value */
+static void intern_put(struct config_data *d, char *value)
 {
-	config_opt_t *opt;
+	struct intern_str *s = intern_of(value);
 	struct hash_node *node;
 
-	int n = hash_find(config_table, name, &node, 1);
-
-	if (n == 0)
-		opt = NULL;
-	else
-		opt = node->value;
+	if (--s->refs || !s->heap)
+		return;
 
-	return opt;
+	if (hash_find(d->strings, value, &node, 1) == 1)
+		hash_del(d->strings, node);
+	epoch_retire(free, s);
 }
 
-char *config_get_value(const char *name)
+static config_opt_t *new_config_opt(struct config_data *d, char *name,
+									 char *value, int copy)
 {
-	char *value;
+	struct arena *arena = hash_arena(d->table);
 	config_opt_t *opt;
 
-	opt = config_get_opt(name);
+	/* short values are inline, sharing them would not save anything */
+	if (!(copy & COPY_VALUE) || !d->strings || value_is_inline(name, value, copy))
+		return alloc_opt(arena, name, value, copy);
 
-	if (opt)
-		value = opt->value;
-	else
-		value = NULL;
+	if (!(value = intern_get(d, value, 0)))
+		return NULL;
 
-	return value;
+	if (!(opt = alloc_opt(arena, name, value, copy & ~COPY_VALUE))) {
+		intern_put(d, value);
+		return NULL;
+	}
+	opt->flags |= OPT_VALUE_INTERN;
+
+	return opt;
 }
 
-int config_set_value(const char *name, const char *value)
+static int opt_list_push(struct opt_list *list, config_opt_t *opt)
 {
-	config_opt_t *opt;
-	opt = config_get_opt(name);
-	if (opt) {
-		free(opt->value);
-		if (!(opt->value = strdup(value)))
-			return -1;
-	} else {
-		if (!config_add_opt(name, value))
+	config_opt_t **opts;
+	size_t cap;
+
+	if (list->n == list->cap) {
+		cap = list->cap ? list->cap * 2 : 16;
+		if (!(opts = realloc(list->opts, sizeof(config_opt_t *) * cap)))
 			return -1;
+		list->opts = opts;
+		list->cap = cap;
 	}
+
+	list->opts[list->n++] = opt;
 	return 0;
 }
 
-void config_set_delim(char d)
+/* add @opt to @list unless it already has @flag */
+static int mark_opt(struct opt_list *list, config_opt_t *opt, int flag)
 {
-	delim = d;
+	if (opt->flags & flag)
+		return 0;
+
+	if (opt_list_push(list, opt) < 0)
+		return -1;
+
+	opt->flags |= flag;
+	return 0;
 }
 
-void config_print_opt(const char *name)
+/* @opt got a new value, called with cfg->lock held */
+static int mark_changed(struct config_data *d, config_opt_t *opt)
 {
-	config_opt_t *opt;
+	if (mark_opt(&d->dirty, opt, OPT_DIRTY) < 0 ||
+		mark_opt(&d->modified, opt, OPT_MODIFIED) < 0)
+		return -1;
+	return 0;
+}
 
-	opt = config_get_opt(name);
-	if (opt == NULL) {
-		fprintf(stdout, "NULL => NULL\n");
-		return;
-	}
+static void clear_dirty(struct config_data *d)
+{
+	size_t i;
 
-	fprintf(stdout, "name => %s\n", opt->name);
-	fprintf(stdout, "value => %s\n", opt->value);
+	for (i = 0; i < d->dirty.n; i++)
+		d->dirty.opts[i]->flags &= ~OPT_DIRTY;
+	d->dirty.n = 0;
 }
 
-static int parse_line(char *string)
+/*
+ * @opt's cold record, made first if @create. Readers make them too, for
+ * the typed cache, so an id and a chunk are each claimed with one
+ * compare and swap and the loser's is dropped. NULL if there is none, or
+ * no memory for it.
+ */
+static struct opt_cold *cold_of(struct config_data *d, config_opt_t *opt,
+								int create)
 {
-	char value[512], name[512], c;
-	int have_name, have_quote;
-	int i = 0;
+	struct opt_cold *chunk, *none = NULL;
+	unsigned id = __atomic_load_n(&opt->cold, __ATOMIC_ACQUIRE), want = 0;
+	size_t idx;
+	int k;
 
-	have_name = have_quote = 0;
+	if (!id) {
+		if (!create)
+			return NULL;
+		id = __atomic_add_fetch(&d->ncold, 1, __ATOMIC_RELAXED);
+		if (!__atomic_compare_exchange_n(&opt->cold, &want, id, 0,
+										 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			id = want;
+	}
 
-	while ((c = *string++) != '\0') {
-		if (c == '"') {
-			if (!have_name) {
-				debug("unexpected '%c'", '"');
-				return -1;
-			}
-			if (have_quote && !END_LINE(*string)) {
-				debug("unexpected '%c' after '%c'", *string, '"');
-				return -1;
-			}
-			have_quote = !have_quote;
-		} else if (c == ' ') {
-			/* ignore spaces outside of quotes. */
-			if (have_quote)
-				value[i++] = c;
-		} else if (c == delim) {
-			if (have_name) {
-				debug("unexpected '%c'", delim);
-				return -1;
-			}
-			have_name = 1;
-			name[i] = '\0';
-			i = 0;
-		} else if (c == '\n') {
-			break;
-		} else {
-			if (have_name)
-				value[i++] = c;
-			else
-				name[i++] = c;
+	/* chunk k holds the ids whose id - 1 + COLD_CHUNK has COLD_SHIFT + k as top bit */
+	idx = (size_t)id - 1 + COLD_CHUNK;
+	k = 63 - __builtin_clzll(idx) - COLD_SHIFT;
+	if (k >= COLD_CHUNKS)
+		return NULL;
+
+	if (!(chunk = __atomic_load_n(&d->cold[k], __ATOMIC_ACQUIRE))) {
+		if (!create ||
+			!(chunk = calloc((size_t)COLD_CHUNK << k, sizeof(struct opt_cold))))
+			return NULL;
+		if (!__atomic_compare_exchange_n(&d->cold[k], &none, chunk, 0,
+										 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			free(chunk);
+			chunk = none;
 		}
 	}
 
-	value[i] = '\0';
+	return chunk + idx - ((size_t)COLD_CHUNK << k);
+}
 
-	if (!have_name) {
-		debug("do not have name");
+/* where the first line that defined @opt is in the file, if @d keeps spans */
+static int opt_set_span(struct config_data *d, config_opt_t *opt,
+						size_t off, size_t len)
+{
+	struct opt_cold *c;
+
+	if (!d->spans)
+		return 0;
+	if (!(c = cold_of(d, opt, 1)))
 		return -1;
+	if (!c->span_len) {
+		c->span_off = off;
+		c->span_len = len;
 	}
-	if (have_quote) {
-		debug("need another quote");
-		return -1;
+
+	return 0;
+}
+
+/* @opt's span from opt_set_span(), NULL if it has none */
+static struct opt_cold *opt_span(struct config_data *d, config_opt_t *opt)
+{
+	struct opt_cold *c = cold_of(d, opt, 0);
+
+	return c && c->span_len ? c : NULL;
+}
+
+/* the dots in @name, a section name with one less can hold it */
+static int count_dots(const char *name)
+{
+	int dots = 0;
+
+	while ((name = strchr(name, '.'))) {
+		dots++;
+		name++;
 	}
 
-	config_add_opt(name, value);
+	return dots;
+}
 
-	return 0;
+/* where a name with @dots dots is in data->section_dots */
+static unsigned long dots_bit(int dots)
+{
+	return 1UL << (dots < 63 ? dots : 63);
 }
 
-int config_load(const char *filename)
+static struct config_section *section_find(struct config_data *d,
+										   const char *name)
 {
-	FILE *fp;
-	char line[1024];
+	struct hash_node *node;
 
-	if (!(config_table = hash_init(HASH_NUM_BUCKETS, HASH_KEY_TYPE_STR)))
-		return -1;
+	if (!d->sections || hash_find(d->sections, name, &node, 1) == 0)
+		return NULL;
 
-	if (!(fp = fopen(filename, "r")))
-		return -1;
+	return node->value;
+}
 
-	while (fgets(line, sizeof(line), fp)) {
-		/* ignore lines that start with a comment or '\n' character */
-		if (*line == comment || *line == '\n')
-			continue;
+/* section_find() for the first @len bytes of @name */
+static struct config_section *section_find_len(struct config_data *d,
+											   const char *name, size_t len)
+{
+	struct config_section *sec;
+	char buf[256], *prefix = buf;
 
-		if (parse_line(line) < 0) {
-			fclose(fp);
-			return -1;
-		}
-	}
+	if (len >= sizeof(buf) && !(prefix = malloc(len + 1)))
+		return NULL;
+	memcpy(prefix, name, len);
+	prefix[len] = '\0';
+	sec = section_find(d, prefix);
+	if (prefix != buf)
+		free(prefix);
 
-	fclose(fp);
-	return 0;
+	return sec;
 }
 
-static int has_space(const char *str)
+/*
+ * A sectioned opt is only in its section, by leaf. A flat "a.b.c" may
+ * be "[a.b] c" or "[a] b.c"; it can only be one of them, see
+ * line_opt_find(), so the first split with a hit is it.
+ */
+static config_opt_t *section_get_opt(struct config_data *d, const char *name)
 {
-	int i;
-	for (i = 0; str[i] != '\0'; i++) {
-		if (isspace(str[i]))
-			return 1;
+	struct config_section *sec;
+	struct hash_node *node;
+	const char *dot = name + strlen(name);
+	int dots = count_dots(name);
+
+	if (!d->sections)
+		return NULL;
+
+	while ((dot = memrchr(name, '.', dot - name))) {
+		/* no section name has as many dots as this prefix */
+		if (!(d->section_dots & dots_bit(--dots)))
+			continue;
+		if ((sec = section_find_len(d, name, dot - name)) &&
+			hash_find(__atomic_load_n(&sec->keys, __ATOMIC_ACQUIRE), dot + 1,
+					  &node, 1))
+			return node->value;
 	}
-	return 0;
+
+	return NULL;
 }
 
-int config_save(const char *filename)
+/*
+ * @name as cfg_get_value() takes it, top level first. A dotted name can
+ * only be at the top level if some top level name has a dot.
+ */
+static config_opt_t *config_get_opt(struct config_data *d, const char *name)
 {
-	FILE *fp;
-	char line[1024];
+	struct hash_node *node;
 
-	if ((fp = fopen(filename, "w")) == NULL)
-		return -1;
+	if ((__atomic_load_n(&d->dotted, __ATOMIC_ACQUIRE) || !strchr(name, '.')) &&
+		hash_find(d->table, name, &node, 1))
+		return opt_of(node);
 
-	int i;
-	struct hash_node *pos;
-	config_opt_t *opt;
+	return section_get_opt(d, name);
+}
 
-	if (!config_table) {
-		fclose(fp);
+/*
+ * hash_add() into one of @d's section tables with the node from @d's
+ * arena: they are HASH_ARENA tables that never use their own, so a
+ * sectioned load does not go back to a malloc() per key.
+ */
+static int section_hash_add(struct config_data *d, struct hash_table *table,
+							void *key, void *value)
+{
+	struct hash_node *node;
+
+	if (!(node = arena_alloc(hash_arena(d->table), sizeof(struct hash_node))))
 		return -1;
-	}
+	node->key = key;
+	node->value = value;
 
-	for (i = 0; i < HASH_NUM_BUCKETS; i++) {
-		hash_for_each_entry(pos, config_table->head + i) {
-			opt = pos->value;
-			if (has_space(opt->value))
-				sprintf(line, "%s %c \"%s\"\n", opt->name, delim, opt->value);
-			else
-				sprintf(line, "%s %c %s\n", opt->name, delim, opt->value);
-			fputs(line, fp);
-		}
+	return hash_add_node(table, node);
+}
+
+/* the section called @name (@len bytes, not terminated), added if new */
+static struct config_section *section_intern(struct config_data *d,
+											 const char *name, size_t len)
+{
+	struct arena *arena = hash_arena(d->table);
+	struct config_section *sec, **list;
+	char *dup;
+
+	if (!(dup = arena_strndup(arena, name, len)))
+		return NULL;
+	if ((sec = section_find(d, dup)))
+		return sec;
+
+	if (!d->sections &&
+		!(d->sections = hash_init(HASH_NUM_BUCKETS, HASH_KEY_TYPE_STR, HASH_ARENA)))
+		return NULL;
+
+	if (!(sec = arena_alloc(arena, sizeof(struct config_section))))
+		return NULL;
+	memset(sec, 0, sizeof(struct config_section));
+	sec->name = dup;
+	sec->name_len = len;
+	if (!(sec->keys = hash_init(HASH_NUM_BUCKETS, HASH_KEY_TYPE_STR, HASH_ARENA)))
+		return NULL;
+
+	if (!(list = realloc(d->section_list,
+						 sizeof(struct config_section *) * (d->nsections + 1))) ||
+		section_hash_add(d, d->sections, sec->name, sec) < 0) {
+		if (list)
+			d->section_list = list;
+		hash_free(sec->keys);
+		return NULL;
 	}
+	d->section_list = list;
+	d->section_list[d->nsections++] = sec;
+	sec->id = d->nsections;
+	d->section_dots |= dots_bit(count_dots(dup));
 
-	fclose(fp);
-	return 0;
+	return sec;
 }
 
-static void config_free_opt(config_opt_t *opt)
+/* index @opt, named by its leaf, under @sec */
+static int section_add(struct config_data *d, struct config_section *sec,
+					   config_opt_t *opt)
 {
-	free(opt->value);
-	free(opt->name);
-	free(opt);
+	opt->section = sec->id;
+	if (section_hash_add(d, sec->keys, opt_name(opt), opt) < 0)
+		return -1;
+
+	return opt_list_push(&sec->opts, opt);
 }
 
-void config_free(void)
+/*
+ * A key added by name alone (cfg_set_value(), the journal) goes into the
+ * section its name up to the last '.' is, if there is one.
+ */
+static struct config_section *section_of(struct config_data *d,
+										 const char *name)
 {
-	int i;
-	struct hash_node *pos;
-	config_opt_t *opt;
+	const char *dot;
 
-	if (!(config_table))
-		return;
+	if (!d->sections || !(dot = strrchr(name, '.')))
+		return NULL;
+
+	return section_find_len(d, name, dot - name);
+}
+
+/*
+ * Make room in a published @sec for one more key: a full keys table or
+ * opts array is replaced by a copy twice its size, which readers pick up
+ * with their next load of the pointer, and the old one is retired. Each
+ * doubling copies the section once, so adding to it stays amortized O(1).
+ */
+static int section_grow_live(struct config_data *d, struct config_section *sec)
+{
+	struct hash_table *keys, *old_keys = sec->keys;
+	config_opt_t **opts, **old_opts = sec->opts.opts;
+	size_t i, cap;
 
-	for (i = 0; i < HASH_NUM_BUCKETS; i++) {
-		hash_for_each_entry(pos, config_table->head + i) {
-			opt = pos->value;
-			config_free_opt(opt);
+	if (!hash_has_room(old_keys)) {
+		if (!(keys = hash_init(sec->opts.n * 2, HASH_KEY_TYPE_STR, HASH_ARENA)))
+			return -1;
+		for (i = 0; i < sec->opts.n; i++) {
+			if (section_hash_add(d, keys, opt_name(old_opts[i]), old_opts[i]) < 0) {
+				hash_free(keys);
+				return -1;
+			}
 		}
+		hash_rehash_finish(keys);
+		__atomic_store_n(&sec->keys, keys, __ATOMIC_RELEASE);
+		epoch_retire(free_table, old_keys);
 	}
 
-	hash_free(config_table);
+	if (sec->opts.n == sec->opts.cap) {
+		cap = sec->opts.cap ? sec->opts.cap * 2 : 16;
+		if (!(opts = malloc(sizeof(config_opt_t *) * cap)))
+			return -1;
+		memcpy(opts, old_opts, sizeof(config_opt_t *) * sec->opts.n);
+		__atomic_store_n(&sec->opts.opts, opts, __ATOMIC_RELEASE);
+		sec->opts.cap = cap;
+		if (old_opts)
+			epoch_retire(free, old_opts);
+	}
+
+	return 0;
+}
+
+/*
+ * section_add() for a published @sec, after section_grow_live(): the
+ * leaf is linked like hash_add_node_live() does, and the opts array
+ * gets its new entry before the release store of the count shows it.
+ */
+static int section_add_live(struct config_data *d, struct config_section *sec,
+							config_opt_t *opt)
+{
+	struct hash_node *node;
+
+	if (!(node = arena_alloc(hash_arena(d->table), sizeof(struct hash_node))))
+		return -1;
+	opt->section = sec->id;
+	node->key = opt_name(opt);
+	node->value = opt;
+	if (hash_add_node_live(sec->keys, node) < 0)
+		return -1;
+
+	sec->opts.opts[sec->opts.n] = opt;
+	__atomic_store_n(&sec->opts.n, sec->opts.n + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* "section.leaf" in @buf if it fits, otherwise malloc()ed */
+static char *join_name(char *buf, size_t size, const char *section,
+					   size_t section_len, const char *leaf)
+{
+	size_t len = strlen(leaf) + 1;
+	char *name = buf;
+
+	if (section_len + 1 + len > size &&
+		!(name = malloc(section_len + 1 + len)))
+		return NULL;
+
+	memcpy(name, section, section_len);
+	name[section_len] = '.';
+	memcpy(name + section_len + 1, leaf, len);
+
+	return name;
+}
+
+/* "section.leaf" for a sectioned @opt, made in @d's arena */
+static char *opt_path(struct config_data *d, config_opt_t *opt)
+{
+	struct config_section *sec;
+	size_t len;
+	char *path;
+
+	if (!opt->section)
+		return opt_name(opt);
+
+	sec = d->section_list[opt->section - 1];
+	len = sec->name_len + 1 + strlen(opt_name(opt)) + 1;
+	if (!(path = arena_alloc(hash_arena(d->table), len)))
+		return NULL;
+
+	return join_name(path, len, sec->name, sec->name_len, opt_name(opt));
+}
+
+/*
+ * The opt @d already has for "@leaf" under @sec (may be NULL), into
+ * *@opt, NULL if there is none. Keys are told apart by their full name,
+ * so "[a] b.c" finds a "[a.b] c" or top level "a.b.c" from before: the
+ * first line for a name wins however it was split. A top level one is
+ * moved under @sec, so the section lists it like its own lines.
+ * Only for data that is not published yet.
+ */
+static int line_opt_find(struct config_data *d, struct config_section *sec,
+						 const char *leaf, config_opt_t **opt)
+{
+	struct hash_node *node;
+	char buf[256], *name;
+
+	if (!sec) {
+		*opt = config_get_opt(d, leaf);
+		return 0;
+	}
+
+	if (hash_find(sec->keys, leaf, &node, 1)) {
+		*opt = node->value;
+		return 0;
+	}
+
+	/* no other split of the name and no dotted top level name, no match */
+	*opt = NULL;
+	if (!d->dotted && !strchr(leaf, '.') && !memchr(sec->name, '.', sec->name_len))
+		return 0;
+
+	if (!(name = join_name(buf, sizeof(buf), sec->name, sec->name_len, leaf)))
+		return -1;
+	*opt = config_get_opt(d, name);
+	if (name != buf)
+		free(name);
+
+	if (*opt && !(*opt)->section) {
+		hash_del(d->table, &(*opt)->node);
+		(*opt)->node.key = opt_name(*opt) + sec->name_len + 1;
+		return section_add(d, sec, *opt);
+	}
+
+	return 0;
+}
+
+/* a new @opt into @d, under @sec if not NULL; line_opt_find() found none */
+static int data_link_opt(struct config_data *d, struct config_section *sec,
+						 config_opt_t *opt)
+{
+	if (sec)
+		return section_add(d, sec, opt);
+
+	if (strchr(opt_name(opt), '.'))
+		d->dotted = 1;
+	return hash_add_node(d->table, &opt->node);
+}
+
+/*
+ * A "leaf = value" line under @sec (may be NULL), for data that is not
+ * published yet. A duplicate keeps the first opt.
+ */
+static config_opt_t *config_add_line_opt(struct config_data *d,
+										 struct config_section *sec,
+										 char *leaf, char *value, int copy)
+{
+	config_opt_t *opt;
+
+	if (line_opt_find(d, sec, leaf, &opt) < 0)
+		return NULL;
+	if (opt)
+		return opt;
+
+	if (!(opt = new_config_opt(d, leaf, value, copy)) ||
+		data_link_opt(d, sec, opt) < 0)
+		return NULL;
+
+	return opt;
+}
+
+/* config_add_line_opt() for "section.leaf" by name, see section_of() */
+static config_opt_t *config_add_name_opt(struct config_data *d, char *name,
+										 char *value)
+{
+	struct config_section *sec = section_of(d, name);
+
+	return config_add_line_opt(d, sec, sec ? name + sec->name_len + 1 : name,
+							   value, COPY_ALL);
+}
+
+/*
+ * "[name]" with optional spaces around the name, "[]" goes back to the
+ * top level (@len 0). Headers start in the first column.
+ */
+static int parse_section(char *line, char *end, char **name, size_t *len)
+{
+	char *close;
+
+	if (!(close = memchr(line, ']', end - line))) {
+		debug("missing ']'");
+		return -1;
+	}
+
+	for (line++; line < close && isspace((unsigned char)*line); line++)
+		;
+	*name = line;
+	for (line = close; line > *name && isspace((unsigned char)line[-1]); line--)
+		;
+	*len = line - *name;
+
+	for (close++; close < end; close++) {
+		if (!isspace((unsigned char)*close)) {
+			debug("unexpected '%c' after ']'", *close);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* the section a "[name]" header line switches to, NULL for "[]" */
+static int parse_section_line(struct config_data *d, char *line, char *end,
+							  struct config_section **sec)
+{
+	char *name;
+	size_t len;
+
+	if (parse_section(line, end, &name, &len) < 0)
+		return -1;
+
+	*sec = NULL;
+	if (len && !(*sec = section_intern(d, name, len)))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * like config_add_opt(), but the last value wins; strings are copied.
+ * Journal replay, the opt then differs from the base file.
+ */
+static config_opt_t *config_put_opt(struct config_data *d, char *name,
+									char *value)
+{
+	config_opt_t *opt;
+
+	if (!(opt = config_get_opt(d, name))) {
+		if (!(opt = config_add_name_opt(d, name, value)))
+			return NULL;
+	} else {
+		if (!(value = d->strings ? intern_get(d, value, 0) :
+			  arena_strdup(hash_arena(d->table), value)))
+			return NULL;
+		if (opt->flags & OPT_VALUE_INTERN)
+			intern_put(d, opt->node.value);
+		opt->node.value = value;
+		if (d->strings)
+			opt->flags |= OPT_VALUE_INTERN;
+	}
+
+	if (mark_opt(&d->modified, opt, OPT_MODIFIED) < 0)
+		return NULL;
+
+	return opt;
+}
+
+static char *opt_value(config_opt_t *opt)
+{
+	return __atomic_load_n(&opt->node.value, __ATOMIC_ACQUIRE);
+}
+
+/* @opt of @d into @copy, under @sec if not NULL, with its span */
+static int clone_opt(struct config_data *copy, struct config_data *d,
+					 struct config_section *sec, config_opt_t *opt)
+{
+	struct opt_cold *span;
+	config_opt_t *new;
+
+	if (!(new = new_config_opt(copy, opt_name(opt), opt_value(opt), COPY_ALL)) ||
+		data_link_opt(copy, sec, new) < 0)
+		return -1;
+
+	if ((span = opt_span(d, opt)))
+		return opt_set_span(copy, new, span->span_off, span->span_len);
+	return 0;
+}
+
+/* what clone_opt() made of @opt, sections have the same ids in @copy */
+static config_opt_t *clone_of(struct config_data *copy, config_opt_t *opt)
+{
+	struct hash_node *node;
+
+	if (!opt->section)
+		return hash_find(copy->table, opt_name(opt), &node, 1) ? opt_of(node) : NULL;
+
+	return hash_find(copy->section_list[opt->section - 1]->keys, opt_name(opt),
+					 &node, 1) ? node->value : NULL;
+}
+
+/*
+ * a private copy of @d's keys plus room for more, strings are copied.
+ * Spans and the dirty and modified lists carry over, the source mapping
+ * stays with @d.
+ */
+static struct config_data *data_clone(struct config_data *d)
+{
+	struct config_data *copy;
+	struct hash_iter iter;
+	struct hash_node *pos;
+	struct config_section *sec, *new_sec;
+	size_t i, j;
+	int k;
+
+	/*
+	 * a bucket per key, so cfg_set_value() can add as many keys again in
+	 * place before the next copy
+	 */
+	if (!(copy = data_new_size(d && d->table->count > HASH_NUM_BUCKETS ?
+							   d->table->count : HASH_NUM_BUCKETS)))
+		return NULL;
+
+	if (!d)
+		return copy;
+
+	if (d->strings && intern_init(copy) < 0)
+		goto fail;
+	copy->spans = d->spans;
+	copy->file_hash = d->file_hash;
+
+	hash_for_each(d->table, &iter, pos) {
+		if (clone_opt(copy, d, NULL, opt_of(pos)) < 0)
+			goto fail;
+	}
+
+	/* interned in the same order, so the ids stay the same */
+	for (k = 0; k < d->nsections; k++) {
+		sec = d->section_list[k];
+		if (!(new_sec = section_intern(copy, sec->name, sec->name_len)))
+			goto fail;
+		for (j = 0; j < sec->opts.n; j++) {
+			if (clone_opt(copy, d, new_sec, sec->opts.opts[j]) < 0)
+				goto fail;
+		}
+	}
+
+	/* in their original order, new keys are appended in that order */
+	for (i = 0; i < d->dirty.n; i++) {
+		if (mark_opt(&copy->dirty, clone_of(copy, d->dirty.opts[i]), OPT_DIRTY) < 0)
+			goto fail;
+	}
+	for (i = 0; i < d->modified.n; i++) {
+		if (mark_opt(&copy->modified, clone_of(copy, d->modified.opts[i]),
+					 OPT_MODIFIED) < 0)
+			goto fail;
+	}
+
+	return copy;
+
+fail:
+	data_free(copy);
+	return NULL;
+}
+
+/* NULL for compiled images, they have no opts */
+static config_opt_t *data_get_opt(struct config_data *d, const char *name)
+{
+	struct mph *mph;
+
+	if (!d || d->image.map)
+		return NULL;
+
+	if ((mph = __atomic_load_n(&d->mph, __ATOMIC_ACQUIRE)))
+		return mph_lookup(mph, name);
+
+	return config_get_opt(d, name);
+}
+
+static char *data_get_value(struct config_data *d, const char *name)
+{
+	config_opt_t *opt;
+
+	if (!d)
+		return NULL;
+
+	if (d->image.map)
+		return (char *)image_lookup(&d->image, name);
+
+	opt = data_get_opt(d, name);
+
+	return opt ? opt_value(opt) : NULL;
+}
+
+/*
+ * Never blocks. The returned string stays valid while the caller is in a
+ * config_read_lock() section; outside of one, only until the next
+ * writer call on @cfg.
+ */
+char *cfg_get_value(config_t *cfg, const char *name)
+{
+	char *value;
+
+	epoch_enter();
+	value = data_get_value(__atomic_load_n(&cfg->data, __ATOMIC_ACQUIRE), name);
+	epoch_exit();
+
+	return value;
+}
+
+static size_t data_get_values(struct config_data *d, const char **names,
+							  size_t n, char **out)
+{
+	struct hash_node *nodes[HASH_BATCH];
+	config_opt_t *opt;
+	size_t i, j, m, found = 0;
+
+	if (!d || d->image.map || __atomic_load_n(&d->mph, __ATOMIC_ACQUIRE)) {
+		for (i = 0; i < n; i++)
+			found += (out[i] = data_get_value(d, names[i])) != NULL;
+		return found;
+	}
+
+	for (i = 0; i < n; i += m) {
+		m = n - i < HASH_BATCH ? n - i : HASH_BATCH;
+		hash_find_many(d->table, (const void **)names + i, m, nodes);
+		for (j = 0; j < m; j++) {
+			/* sectioned keys are not in the table */
+			opt = nodes[j] ? opt_of(nodes[j]) : section_get_opt(d, names[i + j]);
+			found += (out[i + j] = opt ? opt_value(opt) : NULL) != NULL;
+		}
+	}
+
+	return found;
+}
+
+/*
+ * cfg_get_value() for @n names at once, into @out[i] (NULL if missing).
+ * All of them are hashed and their buckets prefetched before the first
+ * is resolved, so a request reading a few dozen keys waits for the cache
+ * misses together instead of one after the other.
+ *
+ * @return: the number of names found
+ */
+size_t cfg_get_values(config_t *cfg, const char **names, size_t n, char **out)
+{
+	size_t found;
+
+	epoch_enter();
+	found = data_get_values(__atomic_load_n(&cfg->data, __ATOMIC_ACQUIRE),
+							names, n, out);
+	epoch_exit();
+
+	return found;
+}
+
+static char *data_get_section_value(struct config_data *d, const char *section,
+									const char *name)
+{
+	struct config_section *sec;
+	struct hash_node *node;
+	char *path, *value;
+
+	if (!d)
+		return NULL;
+
+	if (!section || !*section)
+		return data_get_value(d, name);
+
+	/* images only know the flat names */
+	if (d->image.map) {
+		if (!(path = malloc(strlen(section) + strlen(name) + 2)))
+			return NULL;
+		sprintf(path, "%s.%s", section, name);
+		value = data_get_value(d, path);
+		free(path);
+		return value;
+	}
+
+	if (!(sec = section_find(d, section)) ||
+		hash_find(__atomic_load_n(&sec->keys, __ATOMIC_ACQUIRE), name, &node, 1) == 0)
+		return NULL;
+
+	return opt_value(node->value);
+}
+
+/*
+ * @name under "[@section]", the same as cfg_get_value("section.name")
+ * but only @section and @name are hashed. NULL or "" is the top level.
+ */
+char *cfg_get_section_value(config_t *cfg, const char *section, const char *name)
+{
+	char *value;
+
+	epoch_enter();
+	value = data_get_section_value(__atomic_load_n(&cfg->data, __ATOMIC_ACQUIRE),
+								   section, name);
+	epoch_exit();
+
+	return value;
+}
+
+/*
+ * Start walking the keys of @section in file order, keys set later come
+ * last. Only the config current at this call is walked, so the walk has
+ * to be inside a config_read_lock() section.
+ *
+ * @return: 0, or -1 if there is no such section.
+ */
+int cfg_section_iter(config_t *cfg, config_section_iter_t *iter,
+					 const char *section)
+{
+	struct config_data *d = __atomic_load_n(&cfg->data, __ATOMIC_ACQUIRE);
+
+	iter->section = NULL;
+	iter->pos = 0;
+
+	if (!d || !d->table || !(iter->section = section_find(d, section)))
+		return -1;
+
+	return 0;
+}
+
+/* the next leaf name and value, 0 once there are no more */
+int config_section_next(config_section_iter_t *iter, const char **name,
+						const char **value)
+{
+	const struct config_section *sec = iter->section;
+	config_opt_t *opt;
+
+	/* the count first: cfg_set_value() stores the entry, then the count */
+	if (!sec || iter->pos >= __atomic_load_n(&sec->opts.n, __ATOMIC_ACQUIRE))
+		return 0;
+
+	opt = __atomic_load_n(&sec->opts.opts, __ATOMIC_ACQUIRE)[iter->pos++];
+	*name = opt_name(opt);
+	*value = opt_value(opt);
+	return 1;
+}
+
+/*
+ * Turn @name into a key for cfg_get_by_key(). The key stays valid for
+ * the life of @cfg, whatever is loaded or set: each published config
+ * carries the opts of all resolved names, looked up once when it is
+ * published. A name that is not there (yet) resolves fine and reads as
+ * NULL. Resolving is a writer call, do it once up front.
+ *
+ * @return: the key, or -1 if out of memory.
+ */
+config_key_t cfg_resolve(config_t *cfg, const char *name)
+{
+	struct config_data *d;
+	struct key_table *kt, *old;
+	char **names;
+	int key;
+
+	pthread_mutex_lock(&cfg->lock);
+
+	for (key = 0; key < cfg->nkeys; key++) {
+		if (strcmp(cfg->key_names[key], name) == 0)
+			goto out;
+	}
+
+	if (!(names = realloc(cfg->key_names, sizeof(char *) * (cfg->nkeys + 1))))
+		goto fail;
+	cfg->key_names = names;
+	if (!(names[cfg->nkeys] = strdup(name)))
+		goto fail;
+	cfg->nkeys++;
+
+	if ((d = cfg->data)) {
+		if (!(kt = resolve_keys(cfg, d))) {
+			free(names[--cfg->nkeys]);
+			goto fail;
+		}
+		old = __atomic_exchange_n(&d->keys, kt, __ATOMIC_ACQ_REL);
+		if (old)
+			epoch_retire(free, old);
+	}
+
+out:
+	pthread_mutex_unlock(&cfg->lock);
+	return key;
+
+fail:
+	pthread_mutex_unlock(&cfg->lock);
+	return -1;
+}
+
+/* cfg_get_value() for a key from cfg_resolve(): no hashing, no comparing */
+char *cfg_get_by_key(config_t *cfg, config_key_t key)
+{
+	struct config_data *d;
+	struct key_table *kt;
+	struct key_slot *slot;
+	config_opt_t *opt;
+	char *value = NULL;
+
+	epoch_enter();
+
+	d = __atomic_load_n(&cfg->data, __ATOMIC_ACQUIRE);
+	if (d && (kt = __atomic_load_n(&d->keys, __ATOMIC_ACQUIRE)) &&
+		key >= 0 && key < kt->n) {
+		slot = &kt->slots[key];
+		opt = __atomic_load_n(&slot->opt, __ATOMIC_ACQUIRE);
+		value = opt ? opt_value(opt) : (char *)slot->value;
+	}
+
+	epoch_exit();
+
+	return value;
+}
+
+/* @return: 0 on a hit, 1 on a hit for a value that did not parse, -1 on a miss */
+static int cache_get(struct opt_cache *c, const char *src, int type, int64_t *bits)
+{
+	unsigned seq;
+	int t;
+	const char *s;
+	int64_t b;
+
+	seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+	if (seq & 1)
+		return -1;
+
+	t = __atomic_load_n(&c->type, __ATOMIC_RELAXED);
+	s = __atomic_load_n(&c->src, __ATOMIC_RELAXED);
+	b = __atomic_load_n(&c->bits, __ATOMIC_RELAXED);
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&c->seq, __ATOMIC_RELAXED) != seq)
+		return -1;
+
+	if (s != src || (t & ~CACHE_ERR) != type)
+		return -1;
+
+	*bits = b;
+	return (t & CACHE_ERR) ? 1 : 0;
+}
+
+/* take the seqlock for writing, @wait spins instead of giving up */
+static int cache_lock(struct opt_cache *c, int wait, unsigned *seq)
+{
+	do {
+		*seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+		if (!(*seq & 1) &&
+			__atomic_compare_exchange_n(&c->seq, seq, *seq + 1, 0,
+										__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			return 0;
+		}
+	} while (wait);
+
+	return -1;
+}
+
+static void cache_put(struct opt_cache *c, const char *src, int type, int64_t bits)
+{
+	unsigned seq;
+
+	/* somebody else is filling it, they parsed the same thing */
+	if (cache_lock(c, 0, &seq) < 0)
+		return;
+
+	__atomic_store_n(&c->type, type, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->src, src, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->bits, bits, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * A stale entry never matches the new value anyway, but its src could
+ * be handed out again by malloc() once the old value is reclaimed.
+ */
+static void cache_clear(struct opt_cache *c)
+{
+	unsigned seq;
+
+	cache_lock(c, 1, &seq);
+	__atomic_store_n(&c->src, NULL, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static int parse_int(const char *str, int64_t *bits)
+{
+	char *end;
+	long v;
+
+	errno = 0;
+	v = strtol(str, &end, 0);
+	if (errno || end == str || *end != '\0')
+		return -1;
+
+	*bits = v;
+	return 0;
+}
+
+static int parse_double(const char *str, int64_t *bits)
+{
+	char *end;
+	double v;
+
+	errno = 0;
+	v = strtod(str, &end);
+	if (errno || end == str || *end != '\0')
+		return -1;
+
+	memcpy(bits, &v, sizeof(v));
+	return 0;
+}
+
+static int parse_bool(const char *str, int64_t *bits)
+{
+	static const char *const yes[] = { "1", "true", "yes", "on" };
+	static const char *const no[] = { "0", "false", "no", "off" };
+	size_t i;
+
+	for (i = 0; i < sizeof(yes) / sizeof(yes[0]); i++) {
+		if (strcasecmp(str, yes[i]) == 0) {
+			*bits = 1;
+			return 0;
+		}
+		if (strcasecmp(str, no[i]) == 0) {
+			*bits = 0;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * "1h30m", "1.5s", "250ms": numbers with a unit each, summed up. A bare
+ * number is in seconds. The result is in nanoseconds.
+ */
+static int parse_duration(const char *str, int64_t *bits)
+{
+	static const struct {
+		const char *unit;
+		double ns;
+	} units[] = {
+		{ "ns", 1 }, { "us", 1e3 }, { "ms", 1e6 }, { "s", 1e9 },
+		{ "m", 60e9 }, { "h", 3600e9 }, { "d", 86400e9 },
+	};
+	const char *p = str;
+	char *end;
+	double v, total = 0;
+	size_t i, len = 0;
+
+	do {
+		if (!isdigit((unsigned char)*p) && *p != '.')
+			return -1;
+		v = strtod(p, &end);
+		if (end == p)
+			return -1;
+
+		if (*end == '\0' && p == str) {
+			total = v * 1e9;
+			break;
+		}
+		p = end;
+
+		for (i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+			len = strlen(units[i].unit);
+			if (strncmp(p, units[i].unit, len) == 0 &&
+				!isalpha((unsigned char)p[len]))
+				break;
+		}
+		if (i == sizeof(units) / sizeof(units[0]))
+			return -1;
+
+		total += v * units[i].ns;
+		p += len;
+	} while (*p);
+
+	if (!isfinite(total) || total >= 9.2e18)
+		return -1;
+
+	*bits = (int64_t)total;
+	return 0;
+}
+
+static const struct {
+	int (*parse)(const char *str, int64_t *bits);
+	const char *what;
+} parsers[] = {
+	[CACHE_INT] = { parse_int, "an integer" },
+	[CACHE_DOUBLE] = { parse_double, "a number" },
+	[CACHE_BOOL] = { parse_bool, "a boolean" },
+	[CACHE_DURATION] = { parse_duration, "a duration" },
+};
+
+/*
+ * Look @name up as @type. Opts keep the parsed result until their value
+ * changes, so a value is parsed, and a bad one complained about, once.
+ * Compiled images have nowhere to keep it and parse on every call.
+ */
+static int get_typed(config_t *cfg, const char *name, int type, int64_t *bits)
+{
+	struct config_data *d;
+	struct opt_cold *c;
+	config_opt_t *opt;
+	const char *value;
+	int ret;
+
+	epoch_enter();
+
+	d = __atomic_load_n(&cfg->data, __ATOMIC_ACQUIRE);
+	if (!(opt = data_get_opt(d, name))) {
+		value = data_get_value(d, name);
+		ret = value ? parsers[type].parse(value, bits) : -1;
+		goto out;
+	}
+
+	/* without a cold record, parse it like an image would */
+	value = opt_value(opt);
+	if (!(c = cold_of(d, opt, 1))) {
+		ret = parsers[type].parse(value, bits);
+		goto out;
+	}
+	if ((ret = cache_get(&c->cache, value, type, bits)) >= 0) {
+		ret = ret ? -1 : 0;
+		goto out;
+	}
+
+	if ((ret = parsers[type].parse(value, bits)) < 0)
+		debug("%s: \"%s\" is not %s", name, value, parsers[type].what);
+	if (ret < 0)
+		cache_put(&c->cache, value, type | CACHE_ERR, 0);
+	else
+		cache_put(&c->cache, value, type, *bits);
+
+out:
+	epoch_exit();
+	return ret;
+}
+
+/*
+ * The cfg_get_<type>() calls return -1 and leave *@out alone if @name is
+ * missing or its value does not parse.
+ */
+int cfg_get_int(config_t *cfg, const char *name, long *out)
+{
+	int64_t bits;
+
+	if (get_typed(cfg, name, CACHE_INT, &bits) < 0)
+		return -1;
+
+	*out = bits;
+	return 0;
+}
+
+int cfg_get_double(config_t *cfg, const char *name, double *out)
+{
+	int64_t bits;
+
+	if (get_typed(cfg, name, CACHE_DOUBLE, &bits) < 0)
+		return -1;
+
+	memcpy(out, &bits, sizeof(*out));
+	return 0;
+}
+
+/* 1/true/yes/on and 0/false/no/off, in any case */
+int cfg_get_bool(config_t *cfg, const char *name, int *out)
+{
+	int64_t bits;
+
+	if (get_typed(cfg, name, CACHE_BOOL, &bits) < 0)
+		return -1;
+
+	*out = bits;
+	return 0;
+}
+
+/* nanoseconds, from units ns, us, ms, s, m, h and d: "1m30s", "2.5ms" */
+int cfg_get_duration(config_t *cfg, const char *name, int64_t *out)
+{
+	int64_t bits;
+
+	if (get_typed(cfg, name, CACHE_DURATION, &bits) < 0)
+		return -1;
+
+	*out = bits;
+	return 0;
+}
+
+/*
+ * Add @name to the published @d in place, for cfg_set_value(): the opt
+ * comes from d's arena and is linked with hash_add_node_live(), into its
+ * section instead if it has one, and resolved keys waiting for that name
+ * get it. NULL when the table is full and has to be copied instead.
+ */
+static config_opt_t *data_add_live(config_t *cfg, struct config_data *d,
+								   const char *name, const char *value)
+{
+	struct config_section *sec = section_of(d, name);
+	struct key_table *kt;
+	config_opt_t *opt;
+	int i;
+
+	if (sec ? section_grow_live(d, sec) < 0 : !hash_has_room(d->table))
+		return NULL;
+
+	if (sec) {
+		if (!(opt = new_config_opt(d, (char *)name + sec->name_len + 1,
+								   (char *)value, COPY_ALL)) ||
+			section_add_live(d, sec, opt) < 0)
+			return NULL;
+	} else {
+		if (!(opt = new_config_opt(d, (char *)name, (char *)value, COPY_ALL)))
+			return NULL;
+		/* before the link, or config_get_opt() could skip the table */
+		if (strchr(name, '.'))
+			__atomic_store_n(&d->dotted, 1, __ATOMIC_RELEASE);
+		if (hash_add_node_live(d->table, &opt->node) < 0)
+			return NULL;
+	}
+
+	if ((kt = d->keys)) {
+		for (i = 0; i < kt->n; i++) {
+			if (!kt->slots[i].opt && !strcmp(cfg->key_names[i], name))
+				__atomic_store_n(&kt->slots[i].opt, opt, __ATOMIC_RELEASE);
+		}
+	}
+
+	return opt;
+}
+
+/*
+ * An existing key gets its value pointer swapped. A new key is linked
+ * into the current table while it has room; when it is full, a copy
+ * with room for as many keys again is published like a reload, so the
+ * copying is amortized over the inserts.
+ */
+int cfg_set_value(config_t *cfg, const char *name, const char *value)
+{
+	struct config_data *d, *copy;
+	struct opt_cold *c;
+	config_opt_t *opt;
+	char *dup, *old;
+	int ret = -1;
+
+	pthread_mutex_lock(&cfg->lock);
+	d = cfg->data;
+
+	/* compiled images and frozen configs are read-only */
+	if (d && (d->image.map || d->mph))
+		goto out;
+
+	if (d && (opt = config_get_opt(d, name))) {
+		if (mark_changed(d, opt) < 0)
+			goto out;
+		if (d->strings) {
+			/* switch references, the old one goes with its last user */
+			if (!(dup = intern_get(d, value, 1)))
+				goto out;
+		} else if (!(dup = strdup(value))) {
+			goto out;
+		}
+		old = __atomic_exchange_n(&opt->node.value, dup, __ATOMIC_ACQ_REL);
+		if ((c = cold_of(d, opt, 0)))
+			cache_clear(&c->cache);
+		if (opt->flags & OPT_VALUE_INTERN)
+			intern_put(d, old);
+		else if (opt->flags & OPT_VALUE_HEAP)
+			epoch_retire(free, old);
+		if (d->strings) {
+			if (opt->flags & OPT_VALUE_HEAP)
+				d->heap_values--;
+			opt->flags = (opt->flags & ~OPT_VALUE_HEAP) | OPT_VALUE_INTERN;
+		} else {
+			if (!(opt->flags & OPT_VALUE_HEAP))
+				d->heap_values++;
+			opt->flags |= OPT_VALUE_HEAP;
+		}
+	} else if (d && (opt = data_add_live(cfg, d, name, value))) {
+		if (mark_changed(d, opt) < 0)
+			goto out;
+	} else {
+		if (!(copy = data_clone(d)))
+			goto out;
+		if (!(opt = config_add_name_opt(copy, (char *)name, (char *)value)) ||
+			mark_changed(copy, opt) < 0) {
+			data_free(copy);
+			goto out;
+		}
+		if (d) {
+			copy->src = d->src;
+			copy->src_len = d->src_len;
+			d->src = NULL;
+		}
+		publish(cfg, copy);
+	}
+	ret = 0;
+
+out:
+	pthread_mutex_unlock(&cfg->lock);
+	return ret;
+}
+
+void cfg_set_delim(config_t *cfg, char d)
+{
+	cfg->delim = d;
+}
+
+void cfg_print_opt(config_t *cfg, const char *name)
+{
+	char *value;
+
+	epoch_enter();
+
+	if (!(value = data_get_value(__atomic_load_n(&cfg->data, __ATOMIC_ACQUIRE), name))) {
+		fprintf(stdout, "NULL => NULL\n");
+	} else {
+		fprintf(stdout, "name => %s\n", name);
+		fprintf(stdout, "value => %s\n", value);
+	}
+
+	epoch_exit();
+}
+
+/*
+ * Tokenize the line [string, end). Characters that are dropped (spaces
+ * outside of quotes, the quotes themselves) are squeezed out by moving
+ * the rest of the token down, so a token without any is not touched. The
+ * value's terminating NUL goes at the write position, which never passes
+ * the byte being read; if that is @end and @end is not writable (the end
+ * of a mapping) tok->value_unterminated is set instead.
+ *
+ * scan_special() skips over the runs of ordinary characters between the
+ * bytes the grammar cares about, a run is kept as a whole.
+ */
+static int parse_line(config_t *cfg, char *string, char *end, int end_writable,
+					  struct line_tok *tok)
+{
+	char *w, *r, *s, c;
+	int have_name, have_quote;
+
+	have_name = have_quote = 0;
+	tok->name = w = string;
+	tok->value = NULL;
+
+	for (r = string; r < end; r = s + 1) {
+		s = (char *)scan_special(r, end, cfg->delim);
+
+		if (s != r) {
+			/* a value starts at its first kept character */
+			if (have_name && w == tok->value)
+				tok->value = w = r;
+			if (w != r)
+				memmove(w, r, s - r);
+			w += s - r;
+		}
+
+		if (s == end || (c = *s) == '\0' || c == '\n')
+			break;
+
+		if (c == '"') {
+			if (!have_name) {
+				debug("unexpected '%c'", '"');
+				return -1;
+			}
+			if (have_quote && s + 1 < end && !END_LINE(s[1])) {
+				debug("unexpected '%c' after '%c'", s[1], '"');
+				return -1;
+			}
+			have_quote = !have_quote;
+		} else if (c == ' ') {
+			/* ignore spaces outside of quotes. */
+			if (have_quote) {
+				if (w == tok->value)
+					tok->value = w = s;
+				*w++ = c;
+			}
+		} else {
+			/* c == delim */
+			if (have_name) {
+				debug("unexpected '%c'", cfg->delim);
+				return -1;
+			}
+			have_name = 1;
+			*w = '\0';
+			tok->value = w = s + 1;
+		}
+	}
+
+	if (!have_name) {
+		debug("do not have name");
+		return -1;
+	}
+	if (have_quote) {
+		debug("need another quote");
+		return -1;
+	}
+
+	tok->value_len = w - tok->value;
+	tok->value_unterminated = (w == end && !end_writable);
+	if (!tok->value_unterminated)
+		*w = '\0';
+
+	return 0;
+}
+
+/* what cfg_load() reads at a time */
+#define PARSER_CHUNK		65536
+
+/*
+ * A push parser: input comes in pieces of any size and lines of any
+ * length. Bytes are appended to one buffer and complete lines are
+ * tokenized in place there, only the unfinished line at the end is moved
+ * to the front afterwards, and the newline search resumes where it left
+ * off, so every byte is copied and scanned about once.
+ */
+struct config_parser {
+	config_t *cfg;
+	struct config_data *d;
+	char *buf;
+	size_t len;			/* bytes in buf */
+	size_t cap;			/* always > len, parse_line() may write buf[len] */
+	size_t scanned;		/* buf[0, scanned) has no '\n' */
+	size_t off;			/* offset of buf[0] in the input */
+	struct config_section *section;	/* of the last header, NULL for none */
+	int error;
+};
+
+config_parser_t *config_parser_open(config_t *cfg)
+{
+	config_parser_t *p;
+
+	if (!(p = calloc(1, sizeof(config_parser_t))))
+		return NULL;
+
+	if (!(p->d = data_new()) || (cfg->intern && intern_init(p->d) < 0)) {
+		if (p->d)
+			data_free(p->d);
+		free(p);
+		return NULL;
+	}
+	p->d->spans = cfg->preserve;
+
+	p->cfg = cfg;
+	return p;
+}
+
+/* discard everything fed so far, the config is left alone */
+void config_parser_close(config_parser_t *p)
+{
+	if (!p)
+		return;
+
+	if (p->d)
+		data_free(p->d);
+	free(p->buf);
+	free(p);
+}
+
+/* room for @n more bytes at p->buf + p->len */
+static char *parser_reserve(config_parser_t *p, size_t n)
+{
+	size_t cap = p->cap ? p->cap : PARSER_CHUNK;
+	char *buf;
+
+	while (cap <= p->len + n)
+		cap *= 2;
+
+	if (cap != p->cap) {
+		if (!(buf = realloc(p->buf, cap)))
+			return NULL;
+		p->buf = buf;
+		p->cap = cap;
+	}
+
+	return p->buf + p->len;
+}
+
+static int parser_line(config_parser_t *p, char *line, char *end)
+{
+	struct line_tok tok;
+	config_opt_t *opt;
+
+	/* ignore lines that start with a comment or '\n' character */
+	if (line == end || *line == p->cfg->comment)
+		return 0;
+
+	if (*line == '[')
+		return parse_section_line(p->d, line, end, &p->section);
+
+	if (parse_line(p->cfg, line, end, 1, &tok) < 0 ||
+		!(opt = config_add_line_opt(p->d, p->section, tok.name, tok.value, COPY_ALL)))
+		return -1;
+
+	return opt_set_span(p->d, opt, p->off + (line - p->buf), end - line);
+}
+
+/* parse the @n bytes just written behind p->buf + p->len */
+static int parser_commit(config_parser_t *p, size_t n)
+{
+	char *line, *nl, *end;
+
+	p->len += n;
+	if (p->error)
+		return -1;
+
+	line = p->buf;
+	end = p->buf + p->len;
+	for (nl = p->buf + p->scanned;
+		 (nl = memchr(nl, '\n', end - nl)); line = nl = nl + 1) {
+		if (parser_line(p, line, nl) < 0) {
+			p->error = 1;
+			return -1;
+		}
+	}
+
+	p->len = end - line;
+	p->off += line - p->buf;
+	if (line != p->buf && p->len)
+		memmove(p->buf, line, p->len);
+	p->scanned = p->len;
+
+	return 0;
+}
+
+int config_parser_feed(config_parser_t *p, const char *buf, size_t len)
+{
+	char *dst;
+
+	if (p->error)
+		return -1;
+
+	if (!(dst = parser_reserve(p, len))) {
+		p->error = 1;
+		return -1;
+	}
+
+	memcpy(dst, buf, len);
+	return parser_commit(p, len);
+}
+
+/* the last line and the parsed data, @p is freed either way */
+static struct config_data *parser_end(config_parser_t *p)
+{
+	struct config_data *d = NULL;
+
+	if (!p->error && p->len && parser_line(p, p->buf, p->buf + p->len) < 0)
+		p->error = 1;
+
+	if (!p->error) {
+		d = p->d;
+		p->d = NULL;
+	}
+
+	config_parser_close(p);
+	return d;
+}
+
+/*
+ * Publish what was fed, unless any of it failed to parse. @p is freed
+ * in both cases.
+ */
+int config_parser_finish(config_parser_t *p)
+{
+	config_t *cfg = p->cfg;
+	struct config_data *d;
+
+	if (!(d = parser_end(p)))
+		return -1;
+
+	publish_file(cfg, d, NULL, SOURCE_NONE, 0);
+	return 0;
+}
+
+/* read @fd to the end, straight into the parser's buffer */
+static struct config_data *parse_fd(config_t *cfg, int fd)
+{
+	config_parser_t *p;
+	struct config_data *d;
+	struct watch_hash h;
+	char *dst;
+	ssize_t n;
+
+	if (!(p = config_parser_open(cfg)))
+		return NULL;
+
+	watch_hash_init(&h);
+	for (;;) {
+		if (!(dst = parser_reserve(p, PARSER_CHUNK))) {
+			p->error = 1;
+			break;
+		}
+		if ((n = read(fd, dst, PARSER_CHUNK)) < 0) {
+			if (errno == EINTR)
+				continue;
+			p->error = 1;
+			break;
+		}
+		if (n == 0)
+			break;
+		watch_hash_update(&h, dst, n);
+		if (parser_commit(p, n) < 0)
+			break;
+	}
+
+	if ((d = parser_end(p)))
+		d->file_hash = watch_hash_final(&h);
+	return d;
+}
+
+/*
+ * cfg_set_journal(): saves append "name = value" lines for the keys set
+ * since the last save to <file>.journal, one batch between a begin and a
+ * commit line. A batch cut short by a crash has no commit line and is
+ * skipped when the journal is replayed over the base file on load.
+ */
+#define JOURNAL_SUFFIX		".journal"
+#define JOURNAL_BEGIN		" begin"
+#define JOURNAL_COMMIT		" commit"
+
+static char *journal_path(const char *filename)
+{
+	char *path;
+
+	if (!(path = malloc(strlen(filename) + sizeof(JOURNAL_SUFFIX))))
+		return NULL;
+
+	strcpy(path, filename);
+	strcat(path, JOURNAL_SUFFIX);
+	return path;
+}
+
+/* is [line, end) the comment character followed by @marker */
+static int journal_marker(config_t *cfg, const char *line, const char *end,
+						  const char *marker)
+{
+	size_t len = strlen(marker);
+
+	return (size_t)(end - line) == len + 1 && *line == cfg->comment &&
+		!memcmp(line + 1, marker, len);
+}
+
+/* apply the lines [line, end) of a committed batch, the last value wins */
+static int replay_batch(config_t *cfg, struct config_data *d, char *line,
+						char *end)
+{
+	struct line_tok tok;
+	char *nl;
+
+	for (; line < end; line = nl + 1) {
+		nl = memchr(line, '\n', end - line);
+
+		if (line == nl || *line == cfg->comment)
+			continue;
+
+		if (parse_line(cfg, line, nl, 1, &tok) < 0 ||
+			!config_put_opt(d, tok.name, tok.value))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* replay the committed batches of @filename's journal, if any, over @d */
+static int replay_journal(config_t *cfg, struct config_data *d,
+						  const char *filename)
+{
+	struct file_buf b = { 0 };
+	char *path, *line, *nl, *end, *batch = NULL;
+	int ret = -1;
+
+	if (!(path = journal_path(filename)))
+		return -1;
+
+	if (file_read_all(path, &b) < 0) {
+		if (errno == ENOENT)
+			ret = 0;
+		goto out;
+	}
+
+	/* a torn last line can only belong to an uncommitted batch */
+	end = b.data + b.len;
+	for (line = b.data; (nl = memchr(line, '\n', end - line)); line = nl + 1) {
+		if (journal_marker(cfg, line, nl, JOURNAL_BEGIN)) {
+			batch = nl + 1;
+		} else if (batch && journal_marker(cfg, line, nl, JOURNAL_COMMIT)) {
+			if (replay_batch(cfg, d, batch, line) < 0)
+				goto out;
+			batch = NULL;
+		}
+	}
+	ret = 0;
+
+out:
+	free(path);
+	file_buf_free(&b);
+	return ret;
+}
+
+/*
+ * cfg_set_preserve(): keep the loaded file mapped read-only for
+ * save_preserve(), the spans of the opts point into it
+ */
+static int map_source(struct config_data *d, int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		return -1;
+
+	if (st.st_size > 0) {
+		d->src = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (d->src == MAP_FAILED) {
+			d->src = NULL;
+			return -1;
+		}
+		d->src_len = st.st_size;
+	}
+
+	return 0;
+}
+
+/*
+ * The loaders build new data off to the side and publish it when the
+ * whole file parsed, so readers see either the old or the new config and
+ * a failed load leaves the old one in place.
+ */
+int cfg_load(config_t *cfg, const char *filename)
+{
+	struct config_data *d;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return -1;
+
+	if ((d = parse_fd(cfg, fd)) && cfg->preserve && map_source(d, fd) < 0) {
+		data_free(d);
+		d = NULL;
+	}
+	close(fd);
+	if (!d)
+		return -1;
+
+	if (cfg->journal_ratio && replay_journal(cfg, d, filename) < 0) {
+		data_free(d);
+		return -1;
+	}
+
+	publish_file(cfg, d, filename, SOURCE_TEXT, 0);
+
+	return 0;
+}
+
+/* like cfg_load() from a pipe, socket or stdin, read until EOF */
+int cfg_load_fd(config_t *cfg, int fd)
+{
+	struct config_data *d;
+
+	if (!(d = parse_fd(cfg, fd)))
+		return -1;
+
+	publish_file(cfg, d, NULL, SOURCE_NONE, 0);
+
+	return 0;
+}
+
+/* new data with @filename mapped privately and writable, if not empty */
+static struct config_data *map_file(config_t *cfg, const char *filename,
+									int advice)
+{
+	int fd;
+	struct stat st;
+	struct config_data *d;
+	struct watch_hash h;
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || !(d = data_new())) {
+		close(fd);
+		return NULL;
+	}
+
+	/*
+	 * Writable so tokens can be NUL terminated in place. Every page the
+	 * loader writes to becomes a private anonymous copy, which with one
+	 * key per line or so is nearly every page: what this saves is the
+	 * copy of each string, not the memory of the file.
+	 */
+	if (st.st_size > 0) {
+		d->map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (d->map == MAP_FAILED) {
+			d->map = NULL;
+			close(fd);
+			data_free(d);
+			return NULL;
+		}
+		d->map_len = st.st_size;
+		madvise(d->map, d->map_len, advice);
+	}
+
+	/* before the loader terminates tokens in it */
+	watch_hash_init(&h);
+	watch_hash_update(&h, d->map, d->map_len);
+	d->file_hash = watch_hash_final(&h);
+	d->spans = cfg->preserve;
+	/* values stay in the mapping, only cfg_set_value() interns */
+	if ((cfg->preserve && map_source(d, fd) < 0) ||
+		(cfg->intern && intern_init(d) < 0)) {
+		close(fd);
+		data_free(d);
+		return NULL;
+	}
+	close(fd);
+
+	return d;
+}
+
+static int load_map(config_t *cfg, struct config_data *d)
+{
+	struct config_section *sec = NULL;
+	struct line_tok tok;
+	config_opt_t *opt;
+	char *line, *nl, *map_end, *value;
+
+	map_end = d->map + d->map_len;
+	for (line = d->map; line < map_end; line = nl + 1) {
+		if (!(nl = memchr(line, '\n', map_end - line)))
+			nl = map_end;
+
+		/* ignore lines that start with a comment or '\n' character */
+		if (line == nl || *line == cfg->comment)
+			continue;
+
+		if (*line == '[') {
+			if (parse_section_line(d, line, nl, &sec) < 0)
+				return -1;
+			continue;
+		}
+
+		if (parse_line(cfg, line, nl, nl != map_end, &tok) < 0)
+			return -1;
+
+		value = tok.value;
+		if (tok.value_unterminated &&
+			!(value = arena_strndup(hash_arena(d->table), tok.value,
+									tok.value_len)))
+			return -1;
+		if (!(opt = config_add_line_opt(d, sec, tok.name, value, 0)) ||
+			opt_set_span(d, opt, line - d->map, nl - line) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Like cfg_load(), but names and values are not copied: the file is
+ * mapped privately and tokens are terminated in place, so they point
+ * straight into the mapping. Only values that lose characters (quotes,
+ * spaces) are moved, and only a value running into the end of the file
+ * is copied. The mapping lives as long as the loaded data, so the file
+ * must be replaced by renaming a new one over it: truncating it in place
+ * takes even the private pages away.
+ *
+ * Terminating in place dirties the mapping, so most of its pages end up
+ * copied on write and count against the process like a copy of the file
+ * would; the page cache is not shared with other readers of the file.
+ */
+int cfg_load_mmap(config_t *cfg, const char *filename)
+{
+	struct config_data *d;
+
+	if (!(d = map_file(cfg, filename, MADV_SEQUENTIAL)))
+		return -1;
+
+	if ((d->map && load_map(cfg, d) < 0) ||
+		(cfg->journal_ratio && replay_journal(cfg, d, filename) < 0)) {
+		data_free(d);
+		return -1;
+	}
+
+	publish_file(cfg, d, filename, SOURCE_MMAP, 0);
+
+	return 0;
+}
+
+/* smallest piece of a file worth a thread of its own */
+#define PARALLEL_MIN_CHUNK	(1 << 20)
+
+struct worker_section {
+	char *name;
+	size_t len;
+};
+
+/* cfg_load_parallel(): one per chunk, the lines [start, end) */
+struct load_worker {
+	config_t *cfg;
+	struct config_data *d;
+	char *start;
+	char *end;
+	char *map;
+	char *map_end;
+	struct arena *arena;
+	config_opt_t **opts;
+	size_t nopts;
+	size_t cap;
+	/* headers seen, opt->section is an index + 1 in here until merged */
+	struct worker_section *sections;
+	int nsections;
+	int section;		/* the chunk starts under it, see chunk_headers() */
+	int error;
+};
+
+static int worker_push(struct load_worker *w, config_opt_t *opt)
+{
+	config_opt_t **opts;
+
+	if (w->nopts == w->cap) {
+		w->cap = w->cap ? w->cap * 2 : 1024;
+		if (!(opts = realloc(w->opts, sizeof(config_opt_t *) * w->cap)))
+			return -1;
+		w->opts = opts;
+	}
+
+	w->opts[w->nopts++] = opt;
+	return 0;
+}
+
+/* a header line for the worker, section 0 is "[]" */
+static int worker_section(struct load_worker *w, char *line, char *end,
+						  int *section)
+{
+	struct worker_section *sections;
+	char *name;
+	size_t len;
+
+	if (parse_section(line, end, &name, &len) < 0)
+		return -1;
+
+	*section = 0;
+	if (!len)
+		return 0;
+
+	if (!(sections = realloc(w->sections, sizeof(struct worker_section) *
+							 (w->nsections + 1))))
+		return -1;
+	w->sections = sections;
+	sections[w->nsections].name = name;
+	sections[w->nsections].len = len;
+	*section = ++w->nsections;
+
+	return 0;
+}
+
+/* load_map() for a chunk, opts are collected in file order instead of added */
+static void *load_worker(void *arg)
+{
+	struct load_worker *w = arg;
+	struct line_tok tok;
+	config_opt_t *opt;
+	char *line, *nl, *value;
+	int section = w->section;
+
+	for (line = w->start; line < w->end; line = nl + 1) {
+		if (!(nl = memchr(line, '\n', w->end - line)))
+			nl = w->end;
+
+		/* ignore lines that start with a comment or '\n' character */
+		if (line == nl || *line == w->cfg->comment)
+			continue;
+
+		if (*line == '[') {
+			if (worker_section(w, line, nl, &section) < 0)
+				goto fail;
+			continue;
+		}
+
+		if (parse_line(w->cfg, line, nl, nl != w->map_end, &tok) < 0)
+			goto fail;
+
+		value = tok.value;
+		if (tok.value_unterminated &&
+			!(value = arena_strndup(w->arena, tok.value, tok.value_len)))
+			goto fail;
+
+		if (!(opt = alloc_opt(w->arena, tok.name, value, 0)) ||
+			worker_push(w, opt) < 0 ||
+			opt_set_span(w->d, opt, line - w->map, nl - line) < 0)
+			goto fail;
+		opt->section = section;
+	}
+
+	return NULL;
+
+fail:
+	w->error = 1;
+	return NULL;
+}
+
+/*
+ * A top level name without a '.' has no other spelling, see
+ * line_opt_find(): those opts are bulk added by name alone.
+ */
+static int opt_is_plain(config_opt_t *opt)
+{
+	return !opt->section && !strchr(opt_name(opt), '.');
+}
+
+/*
+ * Intern a worker's sections and add the rest of its opts the way
+ * config_add_line_opt() does, in file order: workers are merged in
+ * order, so the first line for a full name wins here as well.
+ */
+static int merge_worker(struct config_data *d, struct load_worker *w)
+{
+	struct config_section **map = NULL, *sec;
+	config_opt_t *opt, *winner;
+	size_t j;
+	int i, ret = -1;
+
+	if (w->nsections &&
+		!(map = malloc(sizeof(struct config_section *) * w->nsections)))
+		return -1;
+
+	for (i = 0; i < w->nsections; i++) {
+		if (!(map[i] = section_intern(d, w->sections[i].name, w->sections[i].len)))
+			goto out;
+	}
+
+	for (j = 0; j < w->nopts; j++) {
+		opt = w->opts[j];
+		if (opt_is_plain(opt))
+			continue;
+		sec = opt->section ? map[opt->section - 1] : NULL;
+		if (line_opt_find(d, sec, opt_name(opt), &winner) < 0 ||
+			(!winner && data_link_opt(d, sec, opt) < 0))
+			goto out;
+	}
+	ret = 0;
+
+out:
+	free(map);
+	return ret;
+}
+
+/*
+ * Give each worker the header its chunk starts under: the last line
+ * before it that starts with '['. All of them are found in one pass
+ * over the file before any worker runs, the workers write to the
+ * mapping as they terminate and unquote tokens in place.
+ */
+static int chunk_headers(struct config_data *d, struct load_worker *workers,
+						 int nthreads)
+{
+	char *p = d->map, *q, *header = NULL, *nl;
+	int i;
+
+	for (i = 1; i < nthreads; i++) {
+		for (; (q = memchr(p, '[', workers[i].start - p)); p = q + 1) {
+			if (q == d->map || q[-1] == '\n')
+				header = q;
+		}
+		p = workers[i].start;
+
+		/* the header's line ends before the chunk starts */
+		if (header && (!(nl = memchr(header, '\n', p - header)) ||
+					   worker_section(&workers[i], header, nl,
+									  &workers[i].section) < 0))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* tokenize the chunks on @nthreads threads, then merge them into d->table */
+static int load_map_parallel(config_t *cfg, struct config_data *d, int nthreads)
+{
+	struct load_worker *workers;
+	pthread_t *threads;
+	int *started, i, ret = -1;
+	char *map_end = d->map + d->map_len, *p;
+	struct hash_node **nodes = NULL;
+	size_t n = 0, k, j;
+
+	workers = calloc(nthreads, sizeof(struct load_worker));
+	threads = calloc(nthreads, sizeof(pthread_t));
+	started = calloc(nthreads, sizeof(int));
+	d->arenas = calloc(nthreads, sizeof(struct arena));
+	if (!workers || !threads || !started || !d->arenas)
+		goto out;
+	d->narenas = nthreads;
+
+	/* chunks end right after a '\n', or at the end of the file */
+	for (i = 0, p = d->map; i < nthreads; i++) {
+		arena_init(&d->arenas[i]);
+		workers[i].cfg = cfg;
+		workers[i].d = d;
+		workers[i].map = d->map;
+		workers[i].map_end = map_end;
+		workers[i].arena = &d->arenas[i];
+		workers[i].start = p;
+		if (i == nthreads - 1) {
+			p = map_end;
+		} else {
+			p = d->map + d->map_len * (i + 1) / nthreads;
+			if (p < workers[i].start)
+				p = workers[i].start;
+			if (!(p = memchr(p, '\n', map_end - p)))
+				p = map_end;
+			else
+				p++;
+		}
+		workers[i].end = p;
+	}
+
+	if (chunk_headers(d, workers, nthreads) < 0)
+		goto out;
+
+	for (i = 1; i < nthreads; i++)
+		started[i] = !pthread_create(&threads[i], NULL, load_worker, &workers[i]);
+	load_worker(&workers[0]);
+	for (i = 1; i < nthreads; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			load_worker(&workers[i]);
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		if (workers[i].error)
+			goto out;
+		n += workers[i].nopts;
+	}
+
+	if (!(nodes = malloc(sizeof(struct hash_node *) * (n + 1))))
+		goto out;
+
+	/* chunks in file order, so the first occurrence of a key wins */
+	for (i = 0, k = 0; i < nthreads; i++) {
+		for (j = 0; j < workers[i].nopts; j++) {
+			if (opt_is_plain(workers[i].opts[j]))
+				nodes[k++] = &workers[i].opts[j]->node;
+		}
+	}
+
+	if (hash_add_bulk_nodes(d->table, nodes, k, nthreads) < 0)
+		goto out;
+
+	for (i = 0; i < nthreads; i++) {
+		if (merge_worker(d, &workers[i]) < 0)
+			goto out;
+	}
+	ret = 0;
+
+out:
+	if (workers) {
+		for (i = 0; i < nthreads; i++) {
+			free(workers[i].opts);
+			free(workers[i].sections);
+		}
+	}
+	free(workers);
+	free(threads);
+	free(started);
+	free(nodes);
+	return ret;
+}
+
+/*
+ * cfg_load_mmap() on up to @nthreads threads (0: one per core): the file
+ * is cut into chunks at line boundaries that are tokenized side by side,
+ * and the results are merged into the table in parallel as well. Small
+ * files get fewer threads, each at least PARALLEL_MIN_CHUNK bytes.
+ */
+int cfg_load_parallel(config_t *cfg, const char *filename, int nthreads)
+{
+	struct config_data *d;
+	int arg = nthreads;
+
+	if (nthreads <= 0)
+		nthreads = get_nprocs();
+
+	if (!(d = map_file(cfg, filename, MADV_WILLNEED)))
+		return -1;
+
+	if (d->map_len / PARALLEL_MIN_CHUNK + 1 < (size_t)nthreads)
+		nthreads = d->map_len / PARALLEL_MIN_CHUNK + 1;
+
+	if ((d->map && (nthreads > 1 ? load_map_parallel(cfg, d, nthreads) :
+					load_map(cfg, d)) < 0) ||
+		(cfg->journal_ratio && replay_journal(cfg, d, filename) < 0)) {
+		data_free(d);
+		return -1;
+	}
+
+	publish_file(cfg, d, filename, SOURCE_PARALLEL, arg);
+
+	return 0;
+}
+
+static int has_space(const char *str)
+{
+	int i;
+	for (i = 0; str[i] != '\0'; i++) {
+		if (isspace(str[i]))
+			return 1;
+	}
+	return 0;
+}
+
+/* "name = value\n", the value quoted if it has spaces */
+static int save_opt(config_t *cfg, struct file_buf *b, const char *name,
+					const char *value)
+{
+	size_t name_len = strlen(name), value_len = strlen(value);
+	int quote = has_space(value);
+	char *p;
+
+	if (file_buf_reserve(b, name_len + value_len + 6) < 0)
+		return -1;
+
+	p = b->data + b->len;
+	memcpy(p, name, name_len);
+	p += name_len;
+	*p++ = ' ';
+	*p++ = cfg->delim;
+	*p++ = ' ';
+	if (quote)
+		*p++ = '"';
+	memcpy(p, value, value_len);
+	p += value_len;
+	if (quote)
+		*p++ = '"';
+	*p++ = '\n';
+	b->len = p - b->data;
+
+	return 0;
+}
+
+/* "[name]\n", "[]\n" for the top level */
+static int save_header(struct file_buf *b, struct config_section *sec)
+{
+	if (file_buf_putc(b, '[') < 0 ||
+		(sec && file_buf_append(b, sec->name, sec->name_len) < 0) ||
+		file_buf_append(b, "]\n", 2) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * The whole file is formatted into one buffer and handed to
+ * file_replace(), so @filename is never seen half written. Top level
+ * keys come first, then each section under its header.
+ */
+static int save_full(config_t *cfg, struct config_data *d, const char *filename)
+{
+	size_t i;
+	struct hash_iter iter;
+	struct hash_node *pos;
+	struct config_section *sec;
+	struct file_buf b = { 0 };
+	struct iovec iov;
+	config_opt_t *opt;
+	int k, ret = -1;
+
+	if (d->image.map) {
+		for (i = 0; i < image_count(&d->image); i++) {
+			if (save_opt(cfg, &b, image_name(&d->image, i),
+						 image_value(&d->image, i)) < 0)
+				goto out;
+		}
+	} else {
+		hash_for_each(d->table, &iter, pos) {
+			opt = opt_of(pos);
+			if (save_opt(cfg, &b, opt_name(opt), opt_value(opt)) < 0)
+				goto out;
+		}
+	}
+
+	for (k = 0; k < d->nsections; k++) {
+		sec = d->section_list[k];
+		if (file_buf_putc(&b, '\n') < 0 || save_header(&b, sec) < 0)
+			goto out;
+		for (i = 0; i < sec->opts.n; i++) {
+			opt = sec->opts.opts[i];
+			if (save_opt(cfg, &b, opt_name(opt), opt_value(opt)) < 0)
+				goto out;
+		}
+	}
+
+	iov.iov_base = b.data;
+	iov.iov_len = b.len;
+	ret = file_replace(filename, &iov, 1);
+
+out:
+	file_buf_free(&b);
+	return ret;
+}
+
+/* save_preserve(): src[from, to) of opt's line is replaced by b[text, ...) */
+struct patch {
+	config_opt_t *opt;
+	struct opt_cold *span;
+	size_t from;
+	size_t to;
+	size_t text;
+};
+
+static int cmp_patch(const void *a, const void *b)
+{
+	const struct opt_cold *x = ((const struct patch *)a)->span;
+	const struct opt_cold *y = ((const struct patch *)b)->span;
+
+	return x->span_off < y->span_off ? -1 : x->span_off > y->span_off;
+}
+
+/* @value as save_opt() writes it */
+static int save_value(struct file_buf *b, const char *value)
+{
+	int quote = has_space(value);
+
+	if ((quote && file_buf_putc(b, '"') < 0) ||
+		file_buf_append(b, value, strlen(value)) < 0 ||
+		(quote && file_buf_putc(b, '"') < 0))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * cfg_set_preserve(): the file as it was loaded, with the value part of
+ * each modified opt's line replaced and new keys appended in the order
+ * they were set. Comments, blank lines, order and spacing stay as they
+ * were, the unchanged bytes go straight from the mapping to writev().
+ */
+static int save_preserve(config_t *cfg, struct config_data *d,
+						 const char *filename)
+{
+	struct file_buf b = { 0 };
+	struct iovec *iov = NULL;
+	struct patch *patches = NULL, *pt;
+	struct opt_cold *span;
+	config_opt_t *opt;
+	size_t npatches = 0, i, end, at, tail;
+	char *delim;
+	int section, cnt = 0, ret = -1;
+
+	if (!(patches = malloc(sizeof(struct patch) * (d->modified.n + 1))) ||
+		!(iov = malloc(sizeof(struct iovec) * (2 * d->modified.n + 2))))
+		goto out;
+
+	for (i = 0; i < d->modified.n; i++) {
+		if ((span = opt_span(d, d->modified.opts[i]))) {
+			patches[npatches].opt = d->modified.opts[i];
+			patches[npatches++].span = span;
+		}
+	}
+	qsort(patches, npatches, sizeof(struct patch), cmp_patch);
+
+	/* everything after the delimiter and its spaces, up to a '\r' */
+	for (i = 0; i < npatches; i++) {
+		pt = &patches[i];
+		opt = pt->opt;
+		span = pt->span;
+		end = span->span_off + span->span_len;
+		if (end > d->src_len)
+			goto out;
+		if (d->src[end - 1] == '\r')
+			end--;
+
+		pt->text = b.len;
+		if ((delim = memchr(d->src + span->span_off, cfg->delim,
+							end - span->span_off))) {
+			for (at = delim - d->src + 1;
+				 at < end && (d->src[at] == ' ' || d->src[at] == '\t'); at++)
+				;
+		} else {
+			/* no delimiter to keep, the whole line goes */
+			at = span->span_off;
+			if (file_buf_append(&b, opt_name(opt), strlen(opt_name(opt))) < 0 ||
+				file_buf_putc(&b, ' ') < 0 || file_buf_putc(&b, cfg->delim) < 0 ||
+				file_buf_putc(&b, ' ') < 0)
+				goto out;
+		}
+		if (save_value(&b, opt_value(opt)) < 0)
+			goto out;
+		pt->from = at;
+		pt->to = end;
+	}
+
+	/* new keys go after the last line */
+	tail = b.len;
+	if (npatches < d->modified.n && d->src_len &&
+		d->src[d->src_len - 1] != '\n' && file_buf_putc(&b, '\n') < 0)
+		goto out;
+	for (i = 0, section = d->nsections ? -1 : 0; i < d->modified.n; i++) {
+		opt = d->modified.opts[i];
+		if (opt_span(d, opt))
+			continue;
+		/* the file may end in any section */
+		if (opt->section != section) {
+			section = opt->section;
+			if (save_header(&b, section ? d->section_list[section - 1] : NULL) < 0)
+				goto out;
+		}
+		if (save_opt(cfg, &b, opt_name(opt), opt_value(opt)) < 0)
+			goto out;
+	}
+
+	/* b does not move any more, interleave it with the mapping */
+	for (i = 0, at = 0; i < npatches; i++) {
+		pt = &patches[i];
+		iov[cnt].iov_base = d->src + at;
+		iov[cnt++].iov_len = pt->from - at;
+		iov[cnt].iov_base = b.data + pt->text;
+		iov[cnt++].iov_len = (i + 1 < npatches ? pt[1].text : tail) - pt->text;
+		at = pt->to;
+	}
+	iov[cnt].iov_base = d->src + at;
+	iov[cnt++].iov_len = d->src_len - at;
+	iov[cnt].iov_base = b.data + tail;
+	iov[cnt++].iov_len = b.len - tail;
+
+	ret = file_replace(filename, iov, cnt);
+
+out:
+	file_buf_free(&b);
+	free(patches);
+	free(iov);
+	return ret;
+}
+
+/* the whole config to @filename, patching the loaded file if there is one */
+static int save_base(config_t *cfg, struct config_data *d, const char *filename)
+{
+	if (d->src)
+		return save_preserve(cfg, d, filename);
+	return save_full(cfg, d, filename);
+}
+
+/*
+ * Append the dirty opts to the journal as one batch. Once the journal
+ * outgrows journal_ratio percent of the base file both are compacted
+ * into a new base; the batch is appended first, so a crash in between
+ * still replays to the same config.
+ */
+static int save_journal(config_t *cfg, struct config_data *d,
+						const char *filename, off_t base_size)
+{
+	struct file_buf b = { 0 };
+	struct iovec iov;
+	struct config_section *sec;
+	config_opt_t *opt;
+	char *path;
+	off_t size;
+	size_t i;
+	int ret = -1;
+
+	if (!d->dirty.n)
+		return 0;
+
+	if (!(path = journal_path(filename)))
+		return -1;
+
+	if (file_buf_putc(&b, '\n') < 0 || file_buf_putc(&b, cfg->comment) < 0 ||
+		file_buf_append(&b, JOURNAL_BEGIN "\n", sizeof(JOURNAL_BEGIN)) < 0)
+		goto out;
+
+	/* by full name, replay puts them back with config_put_opt() */
+	for (i = 0; i < d->dirty.n; i++) {
+		opt = d->dirty.opts[i];
+		sec = opt->section ? d->section_list[opt->section - 1] : NULL;
+		if ((sec && (file_buf_append(&b, sec->name, sec->name_len) < 0 ||
+					 file_buf_putc(&b, '.') < 0)) ||
+			save_opt(cfg, &b, opt_name(opt), opt_value(opt)) < 0)
+			goto out;
+	}
+
+	if (file_buf_putc(&b, cfg->comment) < 0 ||
+		file_buf_append(&b, JOURNAL_COMMIT "\n", sizeof(JOURNAL_COMMIT)) < 0)
+		goto out;
+
+	iov.iov_base = b.data;
+	iov.iov_len = b.len;
+	if (file_append(path, &iov, 1, &size) < 0)
+		goto out;
+
+	size += b.len;
+	if (size * 100 > base_size * cfg->journal_ratio) {
+		debug("compacting %s, journal %lld bytes", filename, (long long)size);
+		if (save_base(cfg, d, filename) < 0)
+			goto out;
+		unlink(path);
+	}
+	ret = 0;
+
+out:
+	free(path);
+	file_buf_free(&b);
+	return ret;
+}
+
+/*
+ * Without a journal, or when @filename is not the file the config was
+ * loaded from, the whole config is written out, patched into the loaded
+ * file with cfg_set_preserve(). A full save in journal mode drops the
+ * old journal, the new base already has all of it.
+ */
+int cfg_save(config_t *cfg, const char *filename)
+{
+	struct config_data *d;
+	struct stat st;
+	char *path;
+	int ret = -1;
+
+	pthread_mutex_lock(&cfg->lock);
+
+	if (!(d = cfg->data))
+		goto out;
+
+	if (cfg->journal_ratio && !d->image.map && cfg->path &&
+		!strcmp(cfg->path, filename) && stat(filename, &st) == 0) {
+		ret = save_journal(cfg, d, filename, st.st_size);
+	} else {
+		ret = save_base(cfg, d, filename);
+		if (ret == 0 && cfg->journal_ratio && (path = journal_path(filename))) {
+			unlink(path);
+			free(path);
+		}
+	}
+
+	if (ret == 0)
+		clear_dirty(d);
+
+out:
+	pthread_mutex_unlock(&cfg->lock);
+	return ret;
+}
+
+/*
+ * Make cfg_save() keep the layout of the file loaded next: only the
+ * values of keys set since then are rewritten, keys that were not in it
+ * are appended, all other bytes are written back as they were. The file
+ * stays mapped while its data is loaded, so like with cfg_load_mmap() it
+ * must be replaced by renaming a new one over it, not truncated.
+ */
+void cfg_set_preserve(config_t *cfg, int on)
+{
+	pthread_mutex_lock(&cfg->lock);
+	cfg->preserve = !!on;
+	pthread_mutex_unlock(&cfg->lock);
+}
+
+/*
+ * Share one copy of each distinct value between all keys that have it,
+ * from the next load on. cfg_set_value() then moves references instead
+ * of copying, and a replaced value is freed with its last user. Values
+ * of cfg_load_mmap() and cfg_load_parallel() stay in the mapping, there
+ * only cfg_set_value() interns.
+ */
+void cfg_set_intern(config_t *cfg, int on)
+{
+	pthread_mutex_lock(&cfg->lock);
+	cfg->intern = !!on;
+	pthread_mutex_unlock(&cfg->lock);
+}
+
+/*
+ * Make cfg_save() append changes to a journal instead of rewriting the
+ * file, compacting once the journal exceeds @ratio percent of the file's
+ * size. 0 turns the journal off. Takes effect for the next load as well,
+ * which replays the journal.
+ */
+void cfg_set_journal(config_t *cfg, int ratio)
+{
+	pthread_mutex_lock(&cfg->lock);
+	cfg->journal_ratio = ratio > 0 ? ratio : 0;
+	pthread_mutex_unlock(&cfg->lock);
+}
+
+void cfg_free(config_t *cfg)
+{
+	pthread_mutex_lock(&cfg->lock);
+	publish(cfg, NULL);
+	free(cfg->path);
+	cfg->path = NULL;
+	cfg->source = SOURCE_NONE;
+	cfg->frozen = 0;
+	pthread_mutex_unlock(&cfg->lock);
+}
+
+/* load @filename again the way it was loaded last time */
+static int reload(config_t *cfg)
+{
+	char *path;
+	int source, arg, ret = -1;
+
+	pthread_mutex_lock(&cfg->lock);
+	path = cfg->path ? strdup(cfg->path) : NULL;
+	source = cfg->source;
+	arg = cfg->source_arg;
+	pthread_mutex_unlock(&cfg->lock);
+
+	if (!path)
+		return -1;
+
+	if (source == SOURCE_TEXT)
+		ret = cfg_load(cfg, path);
+	else if (source == SOURCE_MMAP)
+		ret = cfg_load_mmap(cfg, path);
+	else if (source == SOURCE_PARALLEL)
+		ret = cfg_load_parallel(cfg, path, arg);
+	else if (source == SOURCE_COMPILED)
+		ret = cfg_load_compiled(cfg, path, arg);
+
+	free(path);
+	return ret;
+}
+
+/*
+ * The content hash of what the last load read, under cfg->lock. An image
+ * is only read past its header when asked to verify it, so it is hashed
+ * the first time a watcher wants that: it stays mapped, read-only.
+ */
+static uint64_t loaded_hash(config_t *cfg)
+{
+	struct config_data *d = cfg->data;
+	struct watch_hash h;
+
+	if (!d)
+		return 0;
+
+	if (d->image.map && !d->file_hash) {
+		watch_hash_init(&h);
+		watch_hash_update(&h, d->image.map, d->image.len);
+		d->file_hash = watch_hash_final(&h);
+	}
+
+	return d->file_hash;
+}
+
+/*
+ * Point the watch at the file of the last load, whichever cfg_load*()
+ * did it, and compare changes with what was loaded from it. Called by
+ * whoever dispatches the watch. @return: -1 if the last load was not
+ * of a file, or its file can not be watched: nothing to reload then.
+ */
+static int watch_sync(config_t *cfg)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&cfg->lock);
+	if (cfg->path && (ret = watch_set_file(cfg->watch, cfg->path,
+										   loaded_hash(cfg))) < 0)
+		debug("cannot watch %s", cfg->path);
+	pthread_mutex_unlock(&cfg->lock);
+
+	return ret;
+}
+
+static int watch_dispatch_timeout(config_t *cfg, int timeout_ms)
+{
+	int ret, sync;
+
+	/* before blocking, a load may have come since the last call */
+	sync = watch_sync(cfg);
+	if ((ret = watch_dispatch(cfg->watch, timeout_ms)) <= 0 || sync < 0)
+		return ret < 0 ? ret : 0;
+
+	if (reload(cfg) < 0) {
+		/* keep the old config, the next change is another try */
+		debug("reload of %s failed", cfg->watch->path);
+		return -1;
+	}
+	/* only what was loaded is the new baseline */
+	watch_sync(cfg);
+
+	if (cfg->reload_cb)
+		cfg->reload_cb(cfg, cfg->reload_arg);
+
+	return 1;
+}
+
+/*
+ * Handle the events pending on the fd cfg_watch() returned, never blocks.
+ *
+ * @return: 1 if the config was reloaded, 0 if there was nothing to do,
+ *          -1 if the changed file failed to load.
+ */
+int cfg_watch_dispatch(config_t *cfg)
+{
+	if (!cfg->watch)
+		return -1;
+
+	return watch_dispatch_timeout(cfg, 0);
+}
+
+static void *watch_thread(void *arg)
+{
+	config_t *cfg = arg;
+
+	while (!__atomic_load_n(&cfg->watch_stop, __ATOMIC_ACQUIRE))
+		watch_dispatch_timeout(cfg, -1);
+
+	return NULL;
+}
+
+/*
+ * Reload the file of the last load whenever it is written or renamed
+ * over, once a burst of events has been quiet for WATCH_DEBOUNCE_MS and
+ * only if its content is not what was loaded. @cb (may be NULL) is
+ * called after each reload has been published. A reload goes through
+ * the same cfg_load*() call as the last load, with its arguments, and a
+ * frozen config stays frozen. A later cfg_load*() of another file moves
+ * the watch there; one not from a file pauses reloads until the next.
+ *
+ * With CONFIG_WATCH_THREAD a thread of its own does all of that and 0 is
+ * returned. Otherwise the return value is an fd to add to the caller's
+ * event loop, cfg_watch_dispatch() is called when it is readable.
+ */
+int cfg_watch(config_t *cfg, int flags, config_reload_cb cb, void *arg)
+{
+	struct watch *w;
+
+	/* loads look at cfg->watch under the lock, see publish_file() */
+	pthread_mutex_lock(&cfg->lock);
+	if (cfg->watch || !cfg->path ||
+		!(w = watch_open(cfg->path, loaded_hash(cfg), WATCH_DEBOUNCE_MS))) {
+		pthread_mutex_unlock(&cfg->lock);
+		return -1;
+	}
+	cfg->reload_cb = cb;
+	cfg->reload_arg = arg;
+	cfg->watch_stop = 0;
+	cfg->watch_threaded = !!(flags & CONFIG_WATCH_THREAD);
+	cfg->watch = w;
+	pthread_mutex_unlock(&cfg->lock);
+
+	if (!cfg->watch_threaded)
+		return watch_fd(w);
+
+	if (pthread_create(&cfg->watch_thread, NULL, watch_thread, cfg) != 0) {
+		pthread_mutex_lock(&cfg->lock);
+		cfg->watch = NULL;
+		cfg->watch_threaded = 0;
+		pthread_mutex_unlock(&cfg->lock);
+		watch_close(w);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* stop watching, a running callback is waited for */
+void cfg_unwatch(config_t *cfg)
+{
+	struct watch *w;
+
+	pthread_mutex_lock(&cfg->lock);
+	w = cfg->watch;
+	pthread_mutex_unlock(&cfg->lock);
+
+	if (!w)
+		return;
+
+	/* not under the lock: the thread takes it to reload */
+	if (cfg->watch_threaded) {
+		__atomic_store_n(&cfg->watch_stop, 1, __ATOMIC_RELEASE);
+		watch_wakeup(w);
+		pthread_join(cfg->watch_thread, NULL);
+		cfg->watch_threaded = 0;
+	}
+
+	pthread_mutex_lock(&cfg->lock);
+	cfg->watch = NULL;
+	pthread_mutex_unlock(&cfg->lock);
+	watch_close(w);
+}
+
+/* totals over d->strings, called with cfg->lock held */
+static void intern_stats(struct config_data *d, struct config_intern_stats *st)
+{
+	struct hash_iter iter;
+	struct hash_node *pos;
+	struct intern_str *s;
+	size_t len, ref_bytes = 0;
+
+	memset(st, 0, sizeof(*st));
+	hash_for_each(d->strings, &iter, pos) {
+		s = pos->value;
+		len = strlen(s->str) + 1;
+		st->strings++;
+		st->refs += s->refs;
+		st->bytes += len;
+		ref_bytes += s->refs * len;
+	}
+
+	st->saved = ref_bytes > st->bytes ? ref_bytes - st->bytes : 0;
+	st->overhead = st->strings * (sizeof(struct intern_str) + sizeof(struct hash_node)) +
+		d->strings->size * sizeof(struct hash_head);
+}
+
+/*
+ * What value interning saves in the current config: value bytes that
+ * would have been copied once per key, against the table and headers
+ * it costs.
+ *
+ * @return: 0, or -1 if the current config is not interned.
+ */
+int cfg_intern_stats(config_t *cfg, struct config_intern_stats *st)
+{
+	struct config_data *d;
+	int ret = -1;
+
+	pthread_mutex_lock(&cfg->lock);
+	if ((d = cfg->data) && d->strings) {
+		intern_stats(d, st);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&cfg->lock);
+
+	return ret;
+}
+
+/*
+ * One "name value" pair per line, for scraping. The hash.* lines are
+ * hash_stats() of the table, hash.chain_hist.<len> counts buckets with
+ * chains of that length, the last one of that length or longer. The
+ * lookup counters are only there with a -DHASH_STATS build.
+ */
+void cfg_dump_stats(config_t *cfg, FILE *fp)
+{
+	static const char *const sources[] = {
+		[SOURCE_NONE] = "none", [SOURCE_TEXT] = "text",
+		[SOURCE_MMAP] = "mmap", [SOURCE_COMPILED] = "compiled",
+		[SOURCE_PARALLEL] = "parallel",
+	};
+	struct config_data *d;
+	struct hash_stats st;
+	struct config_intern_stats ist;
+	struct mph *mph;
+	int source, nkeys, i;
+
+	pthread_mutex_lock(&cfg->lock);
+	source = cfg->source;
+	nkeys = cfg->nkeys;
+	pthread_mutex_unlock(&cfg->lock);
+
+	epoch_enter();
+
+	d = __atomic_load_n(&cfg->data, __ATOMIC_ACQUIRE);
+	fprintf(fp, "config.source %s\n", sources[source]);
+	fprintf(fp, "config.resolved_keys %d\n", nkeys);
+	if (!d)
+		goto out;
+
+	if (d->image.map) {
+		fprintf(fp, "image.count %zu\n", image_count(&d->image));
+		fprintf(fp, "image.slots %llu\n",
+				(unsigned long long)d->image.hdr->nslots);
+	}
+
+	if ((mph = __atomic_load_n(&d->mph, __ATOMIC_ACQUIRE))) {
+		fprintf(fp, "mph.keys %u\n", mph->n);
+		fprintf(fp, "mph.buckets %u\n", mph->nbuckets);
+	}
+
+	if (!d->table)
+		goto out;
+
+	fprintf(fp, "config.heap_values %d\n", d->heap_values);
+	fprintf(fp, "config.sections %d\n", d->nsections);
+
+	hash_stats(d->table, &st);
+	fprintf(fp, "hash.count %d\n", st.count);
+	fprintf(fp, "hash.size %d\n", st.size);
+	fprintf(fp, "hash.load %.3f\n", st.load);
+	fprintf(fp, "hash.longest_chain %d\n", st.longest);
+	for (i = 0; i < HASH_STATS_HIST; i++)
+		fprintf(fp, "hash.chain_hist.%d %d\n", i, st.hist[i]);
+	if (st.stats_enabled) {
+		fprintf(fp, "hash.lookups %lu\n", st.lookups);
+		fprintf(fp, "hash.hits %lu\n", st.hits);
+		fprintf(fp, "hash.misses %lu\n", st.misses);
+		fprintf(fp, "hash.avg_probe %.3f\n", st.avg_probe);
+	}
+
+	/* writers change the interning table */
+	if (cfg_intern_stats(cfg, &ist) == 0) {
+		fprintf(fp, "intern.strings %zu\n", ist.strings);
+		fprintf(fp, "intern.refs %zu\n", ist.refs);
+		fprintf(fp, "intern.bytes %zu\n", ist.bytes);
+		fprintf(fp, "intern.saved %zu\n", ist.saved);
+		fprintf(fp, "intern.overhead %zu\n", ist.overhead);
+	}
+
+out:
+	epoch_exit();
+}
+
+/* index @d's keys with a minimal perfect hash, called with cfg->lock held */
+static int data_freeze(struct config_data *d)
+{
+	struct hash_iter iter;
+	struct hash_node *pos;
+	struct config_section *sec;
+	struct mph *mph = NULL;
+	config_opt_t *opt;
+	const char **names = NULL;
+	void **values = NULL;
+	size_t n = d->table->count, j;
+	int i = 0, k, ret = -1;
+
+	for (k = 0; k < d->nsections; k++)
+		n += d->section_list[k]->opts.n;
+	names = malloc(sizeof(char *) * (n + 1));
+	values = malloc(sizeof(void *) * (n + 1));
+	if (!names || !values || !(mph = malloc(sizeof(struct mph))))
+		goto out;
+
+	hash_for_each(d->table, &iter, pos) {
+		opt = opt_of(pos);
+		names[i] = opt_name(opt);
+		values[i] = opt;
+		i++;
+	}
+
+	/* the mph is by full name, spelled out once in the arena */
+	for (k = 0; k < d->nsections; k++) {
+		sec = d->section_list[k];
+		for (j = 0; j < sec->opts.n; j++, i++) {
+			values[i] = opt = sec->opts.opts[j];
+			if (!(names[i] = opt_path(d, opt)))
+				goto out;
+		}
+	}
+
+	if (mph_build(mph, names, values, i) < 0)
+		goto out;
+
+	__atomic_store_n(&d->mph, mph, __ATOMIC_RELEASE);
+	mph = NULL;
+	ret = 0;
+
+out:
+	free(mph);
+	free(names);
+	free(values);
+	return ret;
+}
+
+/*
+ * Rebuild the current keys into a minimal perfect hash: a lookup is then
+ * one hash, one probe and one compare. Until cfg_unfreeze() the
+ * config is read-only, cfg_set_value() fails, and every load, the
+ * watcher's reloads included, is frozen the same way.
+ */
+int cfg_freeze(config_t *cfg)
+{
+	struct config_data *d;
+	int ret = -1;
+
+	pthread_mutex_lock(&cfg->lock);
+
+	d = cfg->data;
+	if (d && d->table && !d->mph && data_freeze(d) == 0) {
+		cfg->frozen = 1;
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&cfg->lock);
+	return ret;
+}
+
+void cfg_unfreeze(config_t *cfg)
+{
+	struct config_data *d;
+	struct mph *mph;
+
+	pthread_mutex_lock(&cfg->lock);
+
+	cfg->frozen = 0;
+	d = cfg->data;
+	if (d && (mph = __atomic_exchange_n(&d->mph, NULL, __ATOMIC_ACQ_REL)))
+		epoch_retire(free_mph, mph);
+
+	pthread_mutex_unlock(&cfg->lock);
+}
+
+/*
+ * Parse @src and write it to @dst as a compiled image for
+ * cfg_load_compiled().
+ */
+int config_compile(const char *src, const char *dst)
+{
+	struct config cfg = CONFIG_INIT;
+	struct image_builder builder;
+	struct config_data *d;
+	struct config_section *sec;
+	struct hash_iter iter;
+	struct hash_node *pos;
+	config_opt_t *opt;
+	char *name;
+	size_t j;
+	int k, ret = -1;
+
+	image_builder_init(&builder);
+
+	if (cfg_load_mmap(&cfg, src) < 0)
+		goto out;
+
+	d = cfg.data;
+	hash_for_each(d->table, &iter, pos) {
+		opt = opt_of(pos);
+		if (image_builder_add(&builder, opt_name(opt), opt_value(opt)) < 0)
+			goto out;
+	}
+
+	/* images only know full names */
+	for (k = 0; k < d->nsections; k++) {
+		sec = d->section_list[k];
+		for (j = 0; j < sec->opts.n; j++) {
+			opt = sec->opts.opts[j];
+			if (!(name = opt_path(d, opt)) ||
+				image_builder_add(&builder, name, opt_value(opt)) < 0)
+				goto out;
+		}
+	}
+
+	ret = image_builder_write(&builder, dst);
+
+out:
+	image_builder_free(&builder);
+	cfg_free(&cfg);
+	return ret;
+}
+
+/*
+ * Map an image written by config_compile(). Nothing is parsed or
+ * allocated: cfg_get_value() returns strings inside the read-only
+ * mapping and cfg_set_value() fails. @verify checksums the whole
+ * image first, otherwise only the header is checked.
+ */
+int cfg_load_compiled(config_t *cfg, const char *filename, int verify)
+{
+	struct config_data *d;
+
+	if (!(d = calloc(1, sizeof(struct config_data))))
+		return -1;
+
+	if (image_open(&d->image, filename, verify) < 0) {
+		free(d);
+		return -1;
+	}
+
+	publish_file(cfg, d, filename, SOURCE_COMPILED, verify);
+
+	return 0;
+}
+
+config_t *config_open(void)
+{
+	config_t *cfg;
+
+	if (!(cfg = malloc(sizeof(config_t))))
+		return NULL;
+
+	*cfg = (config_t)CONFIG_INIT;
+	return cfg;
+}
+
+/* no reader may still be using @cfg itself, its data is retired as usual */
+void config_close(config_t *cfg)
+{
+	if (!cfg)
+		return;
+
+	cfg_unwatch(cfg);
+	cfg_free(cfg);
+
+	while (cfg->nkeys > 0)
+		free(cfg->key_names[--cfg->nkeys]);
+	free(cfg->key_names);
+	pthread_mutex_destroy(&cfg->lock);
+	free(cfg);
+}
+
+config_t *config_default(void)
+{
+	return &default_config;
+}
+
+void config_read_lock(void)
+{
+	epoch_enter();
+}
+
+void config_read_unlock(void)
+{
+	epoch_exit();
+}
+
+/*
+ * the original single instance interface
+ */
+
+int config_load(const char *filename)
+{
+	return cfg_load(&default_config, filename);
+}
+
+int config_load_fd(int fd)
+{
+	return cfg_load_fd(&default_config, fd);
+}
+
+int config_load_mmap(const char *filename)
+{
+	return cfg_load_mmap(&default_config, filename);
+}
+
+int config_load_parallel(const char *filename, int nthreads)
+{
+	return cfg_load_parallel(&default_config, filename, nthreads);
+}
+
+int config_load_compiled(const char *filename, int verify)
+{
+	return cfg_load_compiled(&default_config, filename, verify);
+}
+
+int config_save(const char *filename)
+{
+	return cfg_save(&default_config, filename);
+}
+
+void config_free(void)
+{
+	cfg_free(&default_config);
+}
+
+void config_set_delim(char d)
+{
+	cfg_set_delim(&default_config, d);
+}
+
+void config_set_journal(int ratio)
+{
+	cfg_set_journal(&default_config, ratio);
+}
+
+char *config_get_section_value(const char *section, const char *name)
+{
+	return cfg_get_section_value(&default_config, section, name);
+}
+
+int config_section_iter(config_section_iter_t *iter, const char *section)
+{
+	return cfg_section_iter(&default_config, iter, section);
+}
+
+void config_set_intern(int on)
+{
+	cfg_set_intern(&default_config, on);
+}
+
+int config_intern_stats(struct config_intern_stats *st)
+{
+	return cfg_intern_stats(&default_config, st);
+}
+
+void config_set_preserve(int on)
+{
+	cfg_set_preserve(&default_config, on);
+}
+
+char *config_get_value(const char *name)
+{
+	return cfg_get_value(&default_config, name);
+}
+
+size_t config_get_values(const char **names, size_t n, char **out)
+{
+	return cfg_get_values(&default_config, names, n, out);
+}
+
+void config_dump_stats(FILE *fp)
+{
+	cfg_dump_stats(&default_config, fp);
+}
+
+config_key_t config_resolve(const char *name)
+{
+	return cfg_resolve(&default_config, name);
+}
+
+char *config_get_by_key(config_key_t key)
+{
+	return cfg_get_by_key(&default_config, key);
+}
+
+int config_get_int(const char *name, long *out)
+{
+	return cfg_get_int(&default_config, name, out);
+}
+
+int config_get_double(const char *name, double *out)
+{
+	return cfg_get_double(&default_config, name, out);
+}
+
+int config_get_bool(const char *name, int *out)
+{
+	return cfg_get_bool(&default_config, name, out);
+}
+
+int config_get_duration(const char *name, int64_t *out)
+{
+	return cfg_get_duration(&default_config, name, out);
+}
+
+int config_set_value(const char *name, const char *value)
+{
+	return cfg_set_value(&default_config, name, value);
+}
+
+void config_print_opt(const char *name)
+{
+	cfg_print_opt(&default_config, name);
+}
+
+int config_freeze(void)
+{
+	return cfg_freeze(&default_config);
+}
+
+void config_unfreeze(void)
+{
+	cfg_unfreeze(&default_config);
+}
+
+int config_watch(int flags, config_reload_cb cb, void *arg)
+{
+	return cfg_watch(&default_config, flags, cb, arg);
+}
+
+int config_watch_dispatch(void)
+{
+	return cfg_watch_dispatch(&default_config);
+}
+
+void config_unwatch(void)
+{
+	cfg_unwatch(&default_config);
 }
@@ -1,16 +1,132 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
+#include <stdio.h>
+#include <stdint.h>
+
 /* example: */
 /* name = "jacky liu" */
 /* age = 25 */
+/* [db.primary] */
+/* pool.size = 8	-> "db.primary.pool.size" */
+
+typedef struct config config_t;
+typedef struct config_parser config_parser_t;
+
+/* walks one section, see cfg_section_iter() */
+typedef struct {
+	const void *section;
+	size_t pos;
+} config_section_iter_t;
+
+/* cfg_intern_stats() */
+struct config_intern_stats {
+	size_t strings;		/* distinct values */
+	size_t refs;		/* keys using them */
+	size_t bytes;		/* of the distinct values */
+	size_t saved;		/* value bytes not stored once per key */
+	size_t overhead;	/* interning table and string headers */
+};
+
+/* a name resolved by cfg_resolve() */
+typedef int config_key_t;
+
+/* called after the watcher published a reload */
+typedef void (*config_reload_cb)(config_t *cfg, void *arg);
+
+/* cfg_watch() flags */
+#define CONFIG_WATCH_THREAD	0x01	/* reload from a background thread */
+
+/*
+ * Every config lives in its own config_t, instances share no state. The
+ * config_*() calls without a handle work on config_default().
+ *
+ * Loads build the new config off to the side and publish it with one
+ * atomic pointer swap, so any number of threads may call cfg_get_value()
+ * while another reloads or calls cfg_set_value(); readers never lock or
+ * wait. Old data is freed once no reader can still see it: a thread that
+ * keeps a returned string across other calls brackets that use with
+ * config_read_lock()/config_read_unlock().
+ */
+config_t *config_open(void);
+void config_close(config_t *cfg);
+config_t *config_default(void);
+void config_read_lock(void);
+void config_read_unlock(void);
+
+int cfg_load(config_t *cfg, const char *filename);
+int cfg_load_fd(config_t *cfg, int fd);
+int cfg_load_mmap(config_t *cfg, const char *filename);
+int cfg_load_parallel(config_t *cfg, const char *filename, int nthreads);
+int cfg_load_compiled(config_t *cfg, const char *filename, int verify);
+int cfg_save(config_t *cfg, const char *filename);
+void cfg_free(config_t *cfg);
+void cfg_set_delim(config_t *cfg, char d);
+void cfg_set_journal(config_t *cfg, int ratio);
+void cfg_set_preserve(config_t *cfg, int on);
+void cfg_set_intern(config_t *cfg, int on);
+char *cfg_get_value(config_t *cfg, const char *name);
+size_t cfg_get_values(config_t *cfg, const char **names, size_t n, char **out);
+char *cfg_get_section_value(config_t *cfg, const char *section, const char *name);
+int cfg_section_iter(config_t *cfg, config_section_iter_t *iter, const char *section);
+int config_section_next(config_section_iter_t *iter, const char **name,
+						const char **value);
+config_key_t cfg_resolve(config_t *cfg, const char *name);
+char *cfg_get_by_key(config_t *cfg, config_key_t key);
+int cfg_get_int(config_t *cfg, const char *name, long *out);
+int cfg_get_double(config_t *cfg, const char *name, double *out);
+int cfg_get_bool(config_t *cfg, const char *name, int *out);
+int cfg_get_duration(config_t *cfg, const char *name, int64_t *out);
+int cfg_set_value(config_t *cfg, const char *name, const char *value);
+void cfg_print_opt(config_t *cfg, const char *name);
+int cfg_freeze(config_t *cfg);
+void cfg_unfreeze(config_t *cfg);
+void cfg_dump_stats(config_t *cfg, FILE *fp);
+int cfg_intern_stats(config_t *cfg, struct config_intern_stats *st);
+int cfg_watch(config_t *cfg, int flags, config_reload_cb cb, void *arg);
+int cfg_watch_dispatch(config_t *cfg);
+void cfg_unwatch(config_t *cfg);
+
+/*
+ * Feed a config in pieces of any size, e.g. as it arrives on a pipe;
+ * config_parser_finish() publishes it into the parser's config.
+ */
+config_parser_t *config_parser_open(config_t *cfg);
+int config_parser_feed(config_parser_t *p, const char *buf, size_t len);
+int config_parser_finish(config_parser_t *p);
+void config_parser_close(config_parser_t *p);
+
+int config_compile(const char *src, const char *dst);
 
 int config_load(const char *filename);
+int config_load_fd(int fd);
+int config_load_mmap(const char *filename);
+int config_load_parallel(const char *filename, int nthreads);
+int config_load_compiled(const char *filename, int verify);
 int config_save(const char *filename);
 void config_free(void);
 void config_set_delim(char d);
+void config_set_journal(int ratio);
+void config_set_preserve(int on);
+void config_set_intern(int on);
 char *config_get_value(const char *name);
+size_t config_get_values(const char **names, size_t n, char **out);
+char *config_get_section_value(const char *section, const char *name);
+int config_section_iter(config_section_iter_t *iter, const char *section);
+config_key_t config_resolve(const char *name);
+char *config_get_by_key(config_key_t key);
+int config_get_int(const char *name, long *out);
+int config_get_double(const char *name, double *out);
+int config_get_bool(const char *name, int *out);
+int config_get_duration(const char *name, int64_t *out);
 int config_set_value(const char *name, const char *value);
 void config_print_opt(const char *name);
+int config_freeze(void);
+void config_unfreeze(void);
+void config_dump_stats(FILE *fp);
+int config_intern_stats(struct config_intern_stats *st);
+int config_watch(int flags, config_reload_cb cb, void *arg);
+int config_watch_dispatch(void);
+void config_unwatch(void);
 
 #endif /* _CONFIG_H_ */
@@ -0,0 +1,179 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "epoch.h"
+#include "debug.h"
+
+struct epoch_thread {
+	uint64_t local;		/* epoch seen on entry, 0 when outside */
+	int nesting;
+	int in_use;
+	struct epoch_thread *next;
+};
+
+struct epoch_item {
+	uint64_t epoch;
+	void (*fn)(void *);
+	void *ptr;
+	struct epoch_item *next;
+};
+
+static uint64_t global_epoch = 1;
+static struct epoch_thread *threads;	/* only ever grows */
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+
+static struct epoch_item *retired;
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct epoch_thread *self;
+
+/* the slot is recycled by the next thread that registers */
+static void thread_exit(void *arg)
+{
+	struct epoch_thread *t = arg;
+
+	__atomic_store_n(&t->local, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&t->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void make_thread_key(void)
+{
+	pthread_key_create(&thread_key, thread_exit);
+}
+
+static struct epoch_thread *thread_register(void)
+{
+	struct epoch_thread *t;
+
+	pthread_once(&thread_key_once, make_thread_key);
+	pthread_mutex_lock(&threads_lock);
+
+	for (t = threads; t; t = t->next) {
+		if (!__atomic_load_n(&t->in_use, __ATOMIC_ACQUIRE))
+			break;
+	}
+
+	if (!t) {
+		if (!(t = calloc(1, sizeof(struct epoch_thread)))) {
+			pthread_mutex_unlock(&threads_lock);
+			abort();
+		}
+		t->next = threads;
+		__atomic_store_n(&threads, t, __ATOMIC_RELEASE);
+	}
+	t->in_use = 1;
+	t->nesting = 0;
+	t->local = 0;
+
+	pthread_mutex_unlock(&threads_lock);
+	pthread_setspecific(thread_key, t);
+
+	return t;
+}
+
+void epoch_enter(void)
+{
+	struct epoch_thread *t = self;
+
+	if (!t)
+		t = self = thread_register();
+
+	if (t->nesting++ == 0) {
+		/*
+		 * seq_cst orders this store before the loads of the read
+		 * section, which a writer's retire relies on.
+		 */
+		__atomic_store_n(&t->local, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST),
+						 __ATOMIC_SEQ_CST);
+	}
+}
+
+void epoch_exit(void)
+{
+	struct epoch_thread *t = self;
+
+	if (--t->nesting == 0)
+		__atomic_store_n(&t->local, 0, __ATOMIC_RELEASE);
+}
+
+/* the oldest epoch a reader is still in, UINT64_MAX when there is none */
+static uint64_t min_active_epoch(void)
+{
+	struct epoch_thread *t;
+	uint64_t min = UINT64_MAX, local;
+
+	for (t = __atomic_load_n(&threads, __ATOMIC_ACQUIRE); t; t = t->next) {
+		local = __atomic_load_n(&t->local, __ATOMIC_SEQ_CST);
+		if (local && local < min)
+			min = local;
+	}
+
+	return min;
+}
+
+int epoch_reclaim(void)
+{
+	struct epoch_item **pp, *item, *ready = NULL;
+	uint64_t min;
+	int pending = 0;
+
+	pthread_mutex_lock(&retired_lock);
+	min = min_active_epoch();
+	for (pp = &retired; (item = *pp);) {
+		if (item->epoch < min) {
+			*pp = item->next;
+			item->next = ready;
+			ready = item;
+		} else {
+			pp = &item->next;
+			pending++;
+		}
+	}
+	pthread_mutex_unlock(&retired_lock);
+
+	/* callbacks run outside the lock, they may retire more */
+	while ((item = ready)) {
+		ready = item->next;
+		item->fn(item->ptr);
+		free(item);
+	}
+
+	return pending;
+}
+
+/*
+ * Call after @ptr is no longer reachable for new readers. Readers that
+ * entered before the epoch is bumped may still hold it, they all have
+ * local <= item->epoch.
+ */
+void epoch_retire(void (*fn)(void *), void *ptr)
+{
+	struct epoch_item *item;
+
+	if (!(item = malloc(sizeof(struct epoch_item)))) {
+		/* better leak than free under a reader */
+		debug("epoch: cannot retire %p", ptr);
+		return;
+	}
+
+	item->fn = fn;
+	item->ptr = ptr;
+	item->epoch = __atomic_fetch_add(&global_epoch, 1, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_lock(&retired_lock);
+	item->next = retired;
+	retired = item;
+	pthread_mutex_unlock(&retired_lock);
+
+	epoch_reclaim();
+}
+
+void epoch_synchronize(void)
+{
+	while (epoch_reclaim())
+		sched_yield();
+}
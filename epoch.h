@@ -0,0 +1,23 @@
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+/*
+ * Epoch based reclamation, one domain for the whole process.
+ *
+ * Readers bracket their accesses with epoch_enter()/epoch_exit(), which
+ * never block: each is a store to a per-thread slot. Writers unpublish a
+ * pointer and hand it to epoch_retire(); it is freed once every thread
+ * that was inside a read section at that time has left it.
+ *
+ * Read sections nest. A thread registers itself (under a mutex) the first
+ * time it enters, which is the only non wait-free step.
+ */
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(void (*fn)(void *), void *ptr);
+/* free what can be freed now, @return: the number of callbacks still pending */
+int epoch_reclaim(void);
+/* wait until everything retired so far is freed */
+void epoch_synchronize(void);
+
+#endif /* _EPOCH_H_ */
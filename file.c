@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "file.h"
+#include "debug.h"
+
+#define FILE_BUF_MIN	4096
+
+/* <limits.h> only has it with _XOPEN_SOURCE, it is 1024 on Linux */
+#ifndef IOV_MAX
+#define IOV_MAX			1024
+#endif
+
+/* room for @n more bytes, the buffer at least doubles */
+int file_buf_reserve(struct file_buf *b, size_t n)
+{
+	size_t cap = b->cap ? b->cap : FILE_BUF_MIN;
+	char *data;
+
+	if (b->len + n <= b->cap)
+		return 0;
+
+	while (cap < b->len + n)
+		cap *= 2;
+
+	if (!(data = realloc(b->data, cap)))
+		return -1;
+
+	b->data = data;
+	b->cap = cap;
+	return 0;
+}
+
+int file_buf_append(struct file_buf *b, const void *data, size_t len)
+{
+	if (file_buf_reserve(b, len) < 0)
+		return -1;
+
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	return 0;
+}
+
+void file_buf_free(struct file_buf *b)
+{
+	free(b->data);
+	memset(b, 0, sizeof(*b));
+}
+
+/* writev() until everything is out, @iov is used up along the way */
+int file_writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t n;
+
+	while (iovcnt > 0) {
+		if (iov->iov_len == 0) {
+			iov++;
+			iovcnt--;
+			continue;
+		}
+
+		if ((n = writev(fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		while (n > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+/* make a rename() or create in the directory of @filename durable */
+static void sync_dir(const char *filename)
+{
+	char *tmp;
+	int fd;
+
+	if (!(tmp = strdup(filename)))
+		return;
+
+	if ((fd = open(dirname(tmp), O_RDONLY | O_DIRECTORY)) >= 0) {
+		if (fsync(fd) < 0)
+			debug("fsync %s: %s", tmp, strerror(errno));
+		close(fd);
+	}
+
+	free(tmp);
+}
+
+/*
+ * Replace @filename with the contents of @iov: they are written to a
+ * temporary file next to it, synced and renamed over it, so @filename
+ * is always either the old or the new file, even after a crash. The new
+ * file keeps the old one's permissions.
+ */
+int file_replace(const char *filename, struct iovec *iov, int iovcnt)
+{
+	struct stat st;
+	size_t tmp_len;
+	char *tmp;
+	int fd, ret = -1;
+
+	tmp_len = strlen(filename) + sizeof(".XXXXXX");
+	if (!(tmp = malloc(tmp_len)))
+		return -1;
+	snprintf(tmp, tmp_len, "%s.XXXXXX", filename);
+
+	if ((fd = mkstemp(tmp)) < 0)
+		goto out;
+
+	if (fchmod(fd, stat(filename, &st) == 0 ? st.st_mode & 07777 : 0644) < 0 ||
+		file_writev_all(fd, iov, iovcnt) < 0 || fsync(fd) < 0) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+	close(fd);
+
+	if (rename(tmp, filename) < 0) {
+		unlink(tmp);
+		goto out;
+	}
+
+	sync_dir(filename);
+	ret = 0;
+
+out:
+	free(tmp);
+	return ret;
+}
+
+/*
+ * Append @iov to @filename, creating it if needed, and fsync it.
+ * @size: if not NULL, the file size before the append
+ */
+int file_append(const char *filename, struct iovec *iov, int iovcnt, off_t *size)
+{
+	struct stat st;
+	int fd, created;
+
+	created = stat(filename, &st) < 0;
+
+	if ((fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || file_writev_all(fd, iov, iovcnt) < 0 ||
+		fsync(fd) < 0) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	if (created)
+		sync_dir(filename);
+	if (size)
+		*size = st.st_size;
+
+	return 0;
+}
+
+/* the whole of @filename into @b, -1 with errno ENOENT if there is none */
+int file_read_all(const char *filename, struct file_buf *b)
+{
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return -1;
+
+	for (;;) {
+		if (file_buf_reserve(b, FILE_BUF_MIN) < 0)
+			goto fail;
+		if ((n = read(fd, b->data + b->len, b->cap - b->len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+		if (n == 0)
+			break;
+		b->len += n;
+	}
+
+	close(fd);
+	return 0;
+
+fail:
+	close(fd);
+	return -1;
+}
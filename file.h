@@ -0,0 +1,32 @@
+#ifndef _FILE_H_
+#define _FILE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* a growable byte buffer, zeroed it is empty */
+struct file_buf {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+int file_buf_reserve(struct file_buf *b, size_t n);
+int file_buf_append(struct file_buf *b, const void *data, size_t len);
+void file_buf_free(struct file_buf *b);
+
+static inline int file_buf_putc(struct file_buf *b, char c)
+{
+	if (b->len == b->cap && file_buf_reserve(b, 1) < 0)
+		return -1;
+	b->data[b->len++] = c;
+	return 0;
+}
+
+int file_writev_all(int fd, struct iovec *iov, int iovcnt);
+int file_replace(const char *filename, struct iovec *iov, int iovcnt);
+int file_append(const char *filename, struct iovec *iov, int iovcnt, off_t *size);
+int file_read_all(const char *filename, struct file_buf *b);
+
+#endif /* _FILE_H_ */
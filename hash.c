@@ -1,6 +1,12 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/random.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "hash.h"
 #include "debug.h"
@@ -8,14 +14,26 @@
 /* 2^31 + 2^29 - 2^25 + 2^22 - 2^19 - 2^16 + 1 */
 #define GOLDEN_RATIO_PRIME_32 0x9e370001UL
 
-static uint32_t hash_int(uint32_t val, uint32_t size)
-{
-	uint32_t hash = val * GOLDEN_RATIO_PRIME_32;
+/* control bytes of the open addressing backend, full slots hold h2 (0..127) */
+#define CTRL_EMPTY		((int8_t)-128)	/* 0b10000000 */
+#define CTRL_DELETED	((int8_t)-2)	/* 0b11111110 */
+#define GROUP_WIDTH		16
+
+#ifdef HASH_STATS
+#define stat_add(table, field, n)	__atomic_fetch_add(&(table)->field, (n), __ATOMIC_RELAXED)
+#define stat_probe(probes)			((probes)++)
+#else
+#define stat_add(table, field, n)	do { } while (0)
+#define stat_probe(probes)			((void)(probes))
+#endif
 
-	return hash % size;
+/* HASH_LEGACY */
+static uint32_t hash_int(uint32_t val)
+{
+	return val * GOLDEN_RATIO_PRIME_32;
 }
 
-static uint32_t hash_str(const char *val, uint32_t size)
+static uint32_t hash_str(const char *val)
 {
 	uint32_t hash = 0;
 	uint32_t seed = 131;	/* 31 131 1313 13131 131313 .. */
@@ -23,35 +41,231 @@ static uint32_t hash_str(const char *val, uint32_t size)
 	while (*val)
 		hash = hash * seed + (uint32_t)*val++;
 
-	return hash % size;
+	return hash;
+}
+
+/*
+ * the default hash, after wyhash (Wang Yi, public domain): 8 or 16 bytes
+ * per step, folded by 64x64->128 bit multiplies.
+ */
+#define WY0		0xa0761d6478bd642fULL
+#define WY1		0xe7037ed1a0b428dbULL
+#define WY2		0x8ebc6af09c88c6e3ULL
+#define WY3		0x589965cc75374cc3ULL
+
+static inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+	__uint128_t r = (__uint128_t)a * b;
+
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wyr8(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint64_t wyr4(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+uint64_t hash_wyhash(const void *key, size_t len, uint64_t seed)
+{
+	const uint8_t *p = key;
+	uint64_t a, b, see1, see2;
+	__uint128_t r;
+	size_t i = len;
+
+	seed ^= wymix(seed ^ WY0, WY1);
+
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+			b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		if (i > 48) {
+			see1 = see2 = seed;
+			do {
+				seed = wymix(wyr8(p) ^ WY1, wyr8(p + 8) ^ seed);
+				see1 = wymix(wyr8(p + 16) ^ WY2, wyr8(p + 24) ^ see1);
+				see2 = wymix(wyr8(p + 32) ^ WY3, wyr8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = wymix(wyr8(p) ^ WY1, wyr8(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = wyr8(p + i - 16);
+		b = wyr8(p + i - 8);
+	}
+
+	r = (__uint128_t)(a ^ WY1) * (b ^ seed);
+	return wymix((uint64_t)r ^ WY0 ^ len, (uint64_t)(r >> 64) ^ WY1);
+}
+
+static uint64_t hash_key(const struct hash_table *table, const void *key)
+{
+	if (table->flags & HASH_LEGACY) {
+		if (table->key_type == HASH_KEY_TYPE_INT)
+			return hash_int(*(int *)key);
+		else
+			return hash_str((char *)key);
+	}
+
+	if (table->key_type == HASH_KEY_TYPE_INT)
+		return table->hash_fn(key, sizeof(int), table->seed);
+	else
+		return table->hash_fn(key, strlen(key), table->seed);
+}
+
+/* a fresh seed per table, so no fixed key set is bad for every table */
+static uint64_t random_seed(void)
+{
+	static uint64_t counter;
+	struct timespec ts;
+	uint64_t seed;
+
+	if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) == sizeof(seed))
+		return seed;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return wymix(ts.tv_sec ^ WY2 ^ (uintptr_t)&ts,
+				 ts.tv_nsec ^ __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED));
 }
 
-struct hash_table *hash_init(int size, int key_type)
+static int hash_key_equal(const struct hash_table *table, const void *a,
+						  const void *b)
+{
+	if (table->key_type == HASH_KEY_TYPE_INT)
+		return *(int *)a == *(int *)b;
+	else
+		return strcmp((char *)a, (char *)b) == 0;
+}
+
+/*
+ * chained backend
+ */
+
+static struct hash_head *new_buckets(int size)
 {
 	int i;
-	struct hash_table *table;
+	struct hash_head *head;
 
-	if (!(table = malloc(sizeof(struct hash_table))))
+	if (!(head = malloc(sizeof(struct hash_head) * size)))
 		return NULL;
 
-	table->size = size;
-	table->key_type = key_type;
-	if (!(table->head = malloc(sizeof(struct hash_head) * table->size))) {
-		free(table);
-		return NULL;
+	for (i = 0; i < size; i++)
+		INIT_HLIST_HEAD(head + i);
+
+	return head;
+}
+
+/*
+ * the high half of the hash scaled to [0, size) with a multiply, the
+ * legacy hashes are too weak up there and keep their modulo.
+ */
+static int hash_offset(struct hash_table *table, const void *key, int size)
+{
+	uint64_t hash = hash_key(table, key);
+
+	if (table->flags & HASH_LEGACY)
+		return (uint32_t)hash % size;
+
+	return ((hash >> 32) * (uint64_t)size) >> 32;
+}
+
+/*
+ * start moving every node into a table of @size buckets, the actual work
+ * is spread over the following hash_add/hash_find calls.
+ */
+static void hash_resize(struct hash_table *table, int size)
+{
+	if (hash_is_rehashing(table) || size == table->size)
+		return;
+
+	/* not fatal: keep using the old buckets */
+	if (!(table->new_head = new_buckets(size)))
+		return;
+
+	table->new_size = size;
+	table->rehash_idx = 0;
+}
+
+/*
+ * move up to @n non-empty buckets, visiting at most n * 10 empty ones so a
+ * sparse table can not stall the caller.
+ */
+static void hash_rehash_step(struct hash_table *table, int n)
+{
+	int empty_visits = n * 10;
+	struct hash_node *pos;
+	struct hlist_node *tmp;
+	struct hash_head *head;
+
+	if (!hash_is_rehashing(table))
+		return;
+
+	while (n > 0 && table->rehash_idx < table->size) {
+		head = table->head + table->rehash_idx;
+		if (hlist_empty(head)) {
+			table->rehash_idx++;
+			if (--empty_visits == 0)
+				return;
+			continue;
+		}
+		hash_for_each_entry_safe(pos, tmp, head) {
+			hlist_del(&pos->node);
+			hlist_add_head(&pos->node, table->new_head +
+						   hash_offset(table, pos->key, table->new_size));
+		}
+		table->rehash_idx++;
+		n--;
 	}
 
-	for (i = 0; i < table->size; i++)
-		INIT_HLIST_HEAD(table->head + i);
+	if (table->rehash_idx >= table->size) {
+		free(table->head);
+		table->head = table->new_head;
+		table->size = table->new_size;
+		table->new_head = NULL;
+		table->new_size = 0;
+		table->rehash_idx = -1;
+	}
+}
 
-	return table;
+/* move everything now, e.g. before readers that must not see a rehash */
+void hash_rehash_finish(struct hash_table *table)
+{
+	while (hash_is_rehashing(table))
+		hash_rehash_step(table, 64);
 }
 
-static struct hash_node *new_hash_node(void *key, void *value)
+static struct hash_node *new_hash_node(struct hash_table *table,
+									   void *key, void *value)
 {
 	struct hash_node *node;
 
-	if (!(node = malloc(sizeof(struct hash_node))))
+	if (table->flags & HASH_ARENA)
+		node = arena_alloc(&table->arena, sizeof(struct hash_node));
+	else
+		node = malloc(sizeof(struct hash_node));
+	if (!node)
 		return NULL;
 
 	node->key = key;
@@ -61,41 +275,42 @@ static struct hash_node *new_hash_node(void *key, void *value)
 	return node;
 }
 
-int hash_add(struct hash_table *table, void *key, void *value)
+static void chain_link(struct hash_table *table, struct hash_node *node)
+{
+	if (hash_is_rehashing(table))
+		hlist_add_head(&node->node, table->new_head +
+					   hash_offset(table, node->key, table->new_size));
+	else
+		hlist_add_head(&node->node, table->head +
+					   hash_offset(table, node->key, table->size));
+	table->count++;
+
+	if (table->count > table->size * HASH_MAX_LOAD)
+		hash_resize(table, table->size * 2 + 1);
+}
+
+static int chain_add(struct hash_table *table, void *key, void *value)
 {
-	int offset;
 	struct hash_node *node;
 
-	if (table->key_type == HASH_KEY_TYPE_INT) {
-		offset = hash_int(*(int *)key, table->size);
-	} else if (table->key_type == HASH_KEY_TYPE_STR) {
-		offset = hash_str((char *)key, table->size);
-	} else {
-		return -1;
-	}
+	hash_rehash_step(table, HASH_REHASH_STEP);
 
-	if (!(node = new_hash_node(key, value)))
+	if (!(node = new_hash_node(table, key, value)))
 		return -1;
 
-	hlist_add_head(&node->node, table->head + offset);
-
+	chain_link(table, node);
 	return 0;
 }
 
-static int hash_int_find(struct hash_table *table, int key,
-						 struct hash_node **node, size_t size)
+static size_t chain_find(struct hash_table *table, struct hash_head *head,
+						 const void *key, struct hash_node **node,
+						 size_t size, size_t i, unsigned long *probes)
 {
-	int offset;
-	size_t i = 0;
 	struct hash_node *pos;
 
-	if (!table)
-		return 0;
-
-	offset = hash_int(key, table->size);
-
-	hash_for_each_entry(pos, table->head + offset) {
-		if (*(int *)pos->key == key) {
+	hash_for_each_entry_acquire(pos, head) {
+		stat_probe(*probes);
+		if (hash_key_equal(table, pos->key, key)) {
 			if (i < size)
 				node[i] = pos;
 			i++;
@@ -105,27 +320,360 @@ static int hash_int_find(struct hash_table *table, int key,
 	return i;
 }
 
-static int hash_str_find(struct hash_table *table, const char *key,
-						 struct hash_node **node, size_t size)
+static void chain_del(struct hash_table *table, struct hash_node *node)
+{
+	if (!hlist_unhashed(&node->node)) {
+		hlist_del(&node->node);
+		table->count--;
+	}
+
+	if (!(table->flags & HASH_ARENA))
+		free(node);
+
+	if (table->size > table->min_size &&
+		table->count < table->size / HASH_MIN_LOAD_DIV)
+		hash_resize(table, table->size / 2 > table->min_size ?
+					table->size / 2 : table->min_size);
+}
+
+/*
+ * open addressing backend
+ *
+ * SwissTable layout: one control byte per slot, grouped by GROUP_WIDTH.
+ * The low 7 bits of the (mixed) hash are kept in the control byte, so a
+ * probe compares a whole group of fingerprints at once and only calls
+ * hash_key_equal() on fingerprint hits. Groups are probed triangularly,
+ * which visits every group since the group count is a power of two.
+ */
+
+static uint32_t mix32(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+}
+
+#define H1(h)	((h) >> 7)
+#define H2(h)	((int8_t)((h) & 0x7f))
+
+/* the legacy hashes need mixing before their low bits are any good */
+static uint64_t oa_hash(const struct hash_table *table, const void *key)
+{
+	uint64_t hash = hash_key(table, key);
+
+	return (table->flags & HASH_LEGACY) ? mix32(hash) : hash;
+}
+
+/* bit i set when ctrl[i] == c */
+static uint32_t group_match(const int8_t *ctrl, int8_t c)
+{
+#ifdef __SSE2__
+	__m128i group = _mm_load_si128((const __m128i *)ctrl);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(c)));
+#else
+	int i;
+	uint32_t mask = 0;
+
+	for (i = 0; i < GROUP_WIDTH; i++)
+		if (ctrl[i] == c)
+			mask |= 1U << i;
+	return mask;
+#endif
+}
+
+/* bit i set when ctrl[i] is empty or deleted (the sign bit is set) */
+static uint32_t group_match_free(const int8_t *ctrl)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl));
+#else
+	int i;
+	uint32_t mask = 0;
+
+	for (i = 0; i < GROUP_WIDTH; i++)
+		if (ctrl[i] < 0)
+			mask |= 1U << i;
+	return mask;
+#endif
+}
+
+static int oa_alloc(struct hash_table *table, int capacity)
+{
+	int8_t *ctrl;
+	struct hash_node *slots;
+
+	if (posix_memalign((void **)&ctrl, GROUP_WIDTH, capacity))
+		return -1;
+	if (!(slots = malloc(sizeof(struct hash_node) * capacity))) {
+		free(ctrl);
+		return -1;
+	}
+
+	memset(ctrl, CTRL_EMPTY, capacity);
+	table->ctrl = ctrl;
+	table->slots = slots;
+	table->size = capacity;
+	table->growth_left = capacity - capacity / 8;
+	table->count = 0;
+
+	return 0;
+}
+
+/* the first empty or deleted slot on @hash's probe sequence */
+static int oa_find_free(const struct hash_table *table, uint64_t hash)
+{
+	int groups = table->size / GROUP_WIDTH;
+	int g = H1(hash) & (groups - 1);
+	int step = 0;
+	uint32_t mask;
+
+	for (;;) {
+		mask = group_match_free(table->ctrl + g * GROUP_WIDTH);
+		if (mask)
+			return g * GROUP_WIDTH + __builtin_ctz(mask);
+		g = (g + ++step) & (groups - 1);
+	}
+}
+
+static void oa_insert(struct hash_table *table, uint64_t hash,
+					  void *key, void *value)
+{
+	int i = oa_find_free(table, hash);
+
+	if (table->ctrl[i] == CTRL_EMPTY)
+		table->growth_left--;
+	table->ctrl[i] = H2(hash);
+	table->slots[i].key = key;
+	table->slots[i].value = value;
+	INIT_HLIST_NODE(&table->slots[i].node);
+	table->count++;
+}
+
+/*
+ * rebuild into a table of @capacity slots, this also drops every
+ * tombstone. Unlike the chained backend this is not incremental.
+ */
+static int oa_rehash(struct hash_table *table, int capacity)
 {
-	int offset;
+	int i, old_size = table->size;
+	int8_t *old_ctrl = table->ctrl;
+	struct hash_node *old_slots = table->slots;
+
+	if (oa_alloc(table, capacity) < 0) {
+		table->ctrl = old_ctrl;
+		table->slots = old_slots;
+		return -1;
+	}
+
+	for (i = 0; i < old_size; i++) {
+		if (old_ctrl[i] >= 0)
+			oa_insert(table, oa_hash(table, old_slots[i].key),
+					  old_slots[i].key, old_slots[i].value);
+	}
+
+	free(old_ctrl);
+	free(old_slots);
+	return 0;
+}
+
+static int oa_add(struct hash_table *table, void *key, void *value)
+{
+	int capacity = table->size;
+
+	if (table->growth_left == 0) {
+		/* mostly tombstones: rebuild in place instead of growing */
+		if (table->count < capacity / 2) {
+			if (oa_rehash(table, capacity) < 0)
+				return -1;
+		} else {
+			if (oa_rehash(table, capacity * 2) < 0)
+				return -1;
+		}
+	}
+
+	oa_insert(table, oa_hash(table, key), key, value);
+	return 0;
+}
+
+/* @hash: oa_hash() of @key */
+static size_t oa_find(struct hash_table *table, const void *key, uint64_t hash,
+					  struct hash_node **node, size_t size,
+					  unsigned long *probes)
+{
+	int groups = table->size / GROUP_WIDTH;
+	int g = H1(hash) & (groups - 1);
+	int step = 0, slot;
+	uint32_t mask;
 	size_t i = 0;
-	struct hash_node *pos;
+	const int8_t *ctrl;
 
-	if (!table)
-		return 0;
+	for (;;) {
+		stat_probe(*probes);
+		ctrl = table->ctrl + g * GROUP_WIDTH;
+		mask = group_match(ctrl, H2(hash));
+		while (mask) {
+			slot = g * GROUP_WIDTH + __builtin_ctz(mask);
+			if (hash_key_equal(table, table->slots[slot].key, key)) {
+				if (i < size)
+					node[i] = table->slots + slot;
+				i++;
+			}
+			mask &= mask - 1;
+		}
+		/* an empty slot ends every probe sequence that reached it */
+		if (group_match(ctrl, CTRL_EMPTY) || ++step == groups)
+			return i;
+		g = (g + step) & (groups - 1);
+	}
+}
 
-	offset = hash_str(key, table->size);
+static void oa_del(struct hash_table *table, struct hash_node *node)
+{
+	int slot = node - table->slots;
+	int group = slot & ~(GROUP_WIDTH - 1);
 
-	hash_for_each_entry(pos, table->head + offset) {
-		if (strcmp((char *)pos->key, key) == 0) {
-			if (i < size)
-				node[i] = pos;
-			i++;
+	if (table->ctrl[slot] < 0)
+		return;
+
+	/*
+	 * no probe sequence continued past a group that still has an empty
+	 * slot, so the slot can go back to empty instead of a tombstone.
+	 */
+	if (group_match(table->ctrl + group, CTRL_EMPTY)) {
+		table->ctrl[slot] = CTRL_EMPTY;
+		table->growth_left++;
+	} else {
+		table->ctrl[slot] = CTRL_DELETED;
+	}
+	table->count--;
+}
+
+/*
+ * public interface
+ */
+
+/*
+ * @flags: HASH_OPEN_ADDRESSING selects the open addressing backend, its
+ *         @size is rounded up to a power of two of at least GROUP_WIDTH.
+ *         HASH_LEGACY keeps the original unseeded hashes.
+ */
+struct hash_table *hash_init(int size, int key_type, int flags)
+{
+	int capacity;
+	struct hash_table *table;
+
+	if (size <= 0)
+		return NULL;
+
+	if (key_type != HASH_KEY_TYPE_INT && key_type != HASH_KEY_TYPE_STR)
+		return NULL;
+
+	if (!(table = calloc(1, sizeof(struct hash_table))))
+		return NULL;
+
+	table->key_type = key_type;
+	table->flags = flags;
+	table->rehash_idx = -1;
+	table->hash_fn = hash_wyhash;
+	table->seed = random_seed();
+	arena_init(&table->arena);
+
+	if (flags & HASH_OPEN_ADDRESSING) {
+		for (capacity = GROUP_WIDTH; capacity < size; capacity <<= 1)
+			;
+		if (oa_alloc(table, capacity) < 0) {
+			free(table);
+			return NULL;
+		}
+	} else {
+		table->size = size;
+		if (!(table->head = new_buckets(table->size))) {
+			free(table);
+			return NULL;
 		}
 	}
+	table->min_size = table->size;
 
-	return i;
+	return table;
+}
+
+/*
+ * Hash keys with @fn and @seed instead, only while the table is empty.
+ * Integer keys are hashed as sizeof(int) bytes.
+ */
+int hash_set_fn(struct hash_table *table, hash_fn_t fn, uint64_t seed)
+{
+	if (!fn || table->count)
+		return -1;
+
+	table->hash_fn = fn;
+	table->seed = seed;
+	table->flags &= ~HASH_LEGACY;
+
+	return 0;
+}
+
+/*
+ * with HASH_OPEN_ADDRESSING nodes live inside the table, so pointers from
+ * hash_find() are only valid until the next hash_add().
+ */
+int hash_add(struct hash_table *table, void *key, void *value)
+{
+	if (table->flags & HASH_OPEN_ADDRESSING)
+		return oa_add(table, key, value);
+	else
+		return chain_add(table, key, value);
+}
+
+/*
+ * Link the caller's @node, key and value already set, e.g. one embedded
+ * in a bigger record. The table never frees it, so only HASH_ARENA
+ * tables take them; HASH_OPEN_ADDRESSING copies key and value into a
+ * slot instead and @node is not used after the call.
+ */
+int hash_add_node(struct hash_table *table, struct hash_node *node)
+{
+	if (table->flags & HASH_OPEN_ADDRESSING)
+		return oa_add(table, node->key, node->value);
+
+	if (!(table->flags & HASH_ARENA))
+		return -1;
+
+	hash_rehash_step(table, HASH_REHASH_STEP);
+	INIT_HLIST_NODE(&node->node);
+	chain_link(table, node);
+	return 0;
+}
+
+/*
+ * Link @node into a table that hash_find() callers may be walking at the
+ * same time: its fields are set before one release store of the bucket
+ * head makes it reachable, so a reader sees all of it or none. This
+ * never starts a resize, which readers could not take; see
+ * hash_has_room(). Chained HASH_ARENA tables only, writers serialized by
+ * the caller.
+ */
+int hash_add_node_live(struct hash_table *table, struct hash_node *node)
+{
+	struct hash_head *head;
+
+	if ((table->flags & HASH_OPEN_ADDRESSING) || !(table->flags & HASH_ARENA) ||
+		!hash_has_room(table))
+		return -1;
+
+	head = table->head + hash_offset(table, node->key, table->size);
+	node->node.next = head->first;
+	node->node.pprev = &head->first;
+	if (head->first)
+		head->first->pprev = &node->node.next;
+	__atomic_store_n(&head->first, &node->node, __ATOMIC_RELEASE);
+	table->count++;
+
+	return 0;
 }
 
 /*
@@ -134,41 +682,540 @@ static int hash_str_find(struct hash_table *table, const char *key,
 int hash_find(struct hash_table *table, const void *key,
 			  struct hash_node **node, size_t size)
 {
-	if (table->key_type == HASH_KEY_TYPE_INT) {
-		return hash_int_find(table, *(int *)key, node, size);
-	} else if (table->key_type == HASH_KEY_TYPE_STR) {
-		return hash_str_find(table, (char *)key, node, size);
+	size_t i = 0;
+	unsigned long probes = 0;
+
+	if (!table)
+		return 0;
+
+	if (table->flags & HASH_OPEN_ADDRESSING) {
+		i = oa_find(table, key, oa_hash(table, key), node, size, &probes);
 	} else {
+		hash_rehash_step(table, HASH_REHASH_STEP);
+
+		i = chain_find(table, table->head + hash_offset(table, key, table->size),
+					   key, node, size, i, &probes);
+		if (hash_is_rehashing(table))
+			i = chain_find(table, table->new_head +
+						   hash_offset(table, key, table->new_size),
+						   key, node, size, i, &probes);
+	}
+
+	stat_add(table, lookups, 1);
+	stat_add(table, probes, probes);
+	if (i)
+		stat_add(table, hits, 1);
+	else
+		stat_add(table, misses, 1);
+
+	return i;
+}
+
+/*
+ * Up to HASH_BATCH lookups at once, one pass per level of the structure:
+ * hash every key and prefetch its bucket (or first control group and
+ * slots), then the first node of each chain, then compare. The misses of
+ * a pass overlap instead of each lookup waiting for its own in turn.
+ */
+static void chain_find_batch(struct hash_table *table, const void **keys,
+							 size_t n, struct hash_node **nodes,
+							 unsigned long *probes)
+{
+	struct hash_head *heads[HASH_BATCH];
+	struct hlist_node *first;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		heads[i] = table->head + hash_offset(table, keys[i], table->size);
+		__builtin_prefetch(heads[i]);
+	}
+
+	for (i = 0; i < n; i++) {
+		if ((first = hlist_load_acquire(&heads[i]->first)))
+			__builtin_prefetch(first);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (chain_find(table, heads[i], keys[i], &nodes[i], 1, 0, probes))
+			continue;
+		if (!hash_is_rehashing(table) ||
+			!chain_find(table, table->new_head +
+						hash_offset(table, keys[i], table->new_size),
+						keys[i], &nodes[i], 1, 0, probes))
+			nodes[i] = NULL;
+	}
+}
+
+static void oa_find_batch(struct hash_table *table, const void **keys,
+						  size_t n, struct hash_node **nodes,
+						  unsigned long *probes)
+{
+	uint64_t hashes[HASH_BATCH];
+	int groups = table->size / GROUP_WIDTH, g;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		hashes[i] = oa_hash(table, keys[i]);
+		g = H1(hashes[i]) & (groups - 1);
+		__builtin_prefetch(table->ctrl + g * GROUP_WIDTH);
+		__builtin_prefetch(table->slots + g * GROUP_WIDTH);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!oa_find(table, keys[i], hashes[i], &nodes[i], 1, probes))
+			nodes[i] = NULL;
+	}
+}
+
+/*
+ * hash_find() for each of @n keys, in batches so their cache misses are
+ * in flight together. @nodes[i] is the first node found for @keys[i], or
+ * NULL.
+ *
+ * @return: the number of keys found
+ */
+size_t hash_find_many(struct hash_table *table, const void **keys, size_t n,
+					  struct hash_node **nodes)
+{
+	unsigned long probes = 0;
+	size_t i, m, found = 0;
+
+	if (!table) {
+		memset(nodes, 0, sizeof(struct hash_node *) * n);
 		return 0;
 	}
+
+	for (i = 0; i < n; i += m) {
+		m = n - i < HASH_BATCH ? n - i : HASH_BATCH;
+		if (table->flags & HASH_OPEN_ADDRESSING) {
+			oa_find_batch(table, keys + i, m, nodes + i, &probes);
+		} else {
+			hash_rehash_step(table, HASH_REHASH_STEP);
+			chain_find_batch(table, keys + i, m, nodes + i, &probes);
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		found += nodes[i] != NULL;
+
+	stat_add(table, lookups, n);
+	stat_add(table, probes, probes);
+	stat_add(table, hits, found);
+	stat_add(table, misses, n - found);
+
+	return found;
 }
 
-void hash_del(struct hash_node *node)
+void hash_del(struct hash_table *table, struct hash_node *node)
 {
 	if (!node)
 		return;
 
-	if (!hlist_unhashed(&node->node))
-		hlist_del(&node->node);
+	if (table->flags & HASH_OPEN_ADDRESSING)
+		oa_del(table, node);
+	else
+		chain_del(table, node);
+}
 
-	free(node);
+/*
+ * hash_add_bulk(): entries are spread over as many partitions as there
+ * are threads by bucket number, so each thread links its own buckets.
+ * A stable counting sort puts each partition's entries in array order.
+ */
+struct bulk {
+	struct hash_table *table;
+	struct hash_node **nodes;
+	size_t n;
+	int nthreads;
+	uint32_t *bucket;		/* per entry */
+	size_t *order;			/* entry numbers, grouped by partition */
+	size_t *counts;			/* [thread][partition], then offsets */
+	size_t *part_start;		/* nthreads + 1 */
+};
+
+struct bulk_worker {
+	struct bulk *bulk;
+	int id;
+	void (*fn)(struct bulk_worker *w);
+	size_t added;
+};
+
+static void bulk_slice(struct bulk_worker *w, size_t *from, size_t *to)
+{
+	struct bulk *b = w->bulk;
+
+	*from = b->n * w->id / b->nthreads;
+	*to = b->n * (w->id + 1) / b->nthreads;
 }
 
-void hash_free(struct hash_table *table)
+static void bulk_hash(struct bulk_worker *w)
+{
+	struct bulk *b = w->bulk;
+	size_t *counts = b->counts + (size_t)w->id * b->nthreads;
+	size_t i, from, to;
+
+	bulk_slice(w, &from, &to);
+	for (i = from; i < to; i++) {
+		b->bucket[i] = hash_offset(b->table, b->nodes[i]->key, b->table->size);
+		counts[b->bucket[i] % b->nthreads]++;
+	}
+}
+
+static void bulk_scatter(struct bulk_worker *w)
+{
+	struct bulk *b = w->bulk;
+	size_t *offsets = b->counts + (size_t)w->id * b->nthreads;
+	size_t i, from, to;
+
+	bulk_slice(w, &from, &to);
+	for (i = from; i < to; i++)
+		b->order[offsets[b->bucket[i] % b->nthreads]++] = i;
+}
+
+static void bulk_link(struct bulk_worker *w)
+{
+	struct bulk *b = w->bulk;
+	struct hash_table *table = b->table;
+	struct hash_head *head;
+	struct hash_node *pos, *node;
+	size_t k, i;
+
+	for (k = b->part_start[w->id]; k < b->part_start[w->id + 1]; k++) {
+		i = b->order[k];
+		head = table->head + b->bucket[i];
+
+		node = b->nodes[i];
+		hash_for_each_entry(pos, head) {
+			if (hash_key_equal(table, pos->key, node->key))
+				break;
+		}
+		if (pos)
+			continue;
+
+		INIT_HLIST_NODE(&node->node);
+		hlist_add_head(&node->node, head);
+		w->added++;
+	}
+}
+
+static void *bulk_thread(void *arg)
+{
+	struct bulk_worker *w = arg;
+
+	w->fn(w);
+	return NULL;
+}
+
+/* run @fn on every worker, the calling thread being worker 0 */
+static void bulk_run(struct bulk_worker *workers, int nthreads,
+					 void (*fn)(struct bulk_worker *w))
+{
+	pthread_t threads[nthreads];
+	int i, started[nthreads];
+
+	for (i = 0; i < nthreads; i++)
+		workers[i].fn = fn;
+
+	for (i = 1; i < nthreads; i++)
+		started[i] = !pthread_create(&threads[i], NULL, bulk_thread, &workers[i]);
+
+	fn(&workers[0]);
+
+	/* a thread that did not start does its share here */
+	for (i = 1; i < nthreads; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			fn(&workers[i]);
+	}
+}
+
+/*
+ * Link @n caller nodes (see hash_add_node()) into an empty table at once
+ * using @nthreads threads; of equal keys only the first in array order
+ * is linked. The table is sized for @n up front instead of growing along
+ * the way. Tables without HASH_ARENA or with HASH_OPEN_ADDRESSING take
+ * the nodes one by one.
+ *
+ * @return: the number of keys added, -1 on error (the table is empty).
+ */
+int hash_add_bulk_nodes(struct hash_table *table, struct hash_node **nodes,
+						size_t n, int nthreads)
+{
+	struct bulk b;
+	struct bulk_worker *workers;
+	struct hash_head *head;
+	struct hash_node *node;
+	size_t i, p, t, off;
+	int size, ret = -1;
+
+	if (table->count)
+		return -1;
+
+	if ((table->flags & HASH_OPEN_ADDRESSING) || !(table->flags & HASH_ARENA) ||
+		n < 2 || nthreads < 2) {
+		for (i = 0; i < n; i++) {
+			if (hash_find(table, nodes[i]->key, &node, 1))
+				continue;
+			if (hash_add_node(table, nodes[i]) < 0)
+				return -1;
+		}
+		return table->count;
+	}
+
+	if (n / HASH_MAX_LOAD >= INT32_MAX)
+		return -1;
+
+	/* the load a growing table ends up with after a resize */
+	size = n / HASH_MAX_LOAD * 2 + 1;
+	if (size < table->size)
+		size = table->size;
+
+	memset(&b, 0, sizeof(b));
+	b.table = table;
+	b.nodes = nodes;
+	b.n = n;
+	b.nthreads = nthreads;
+	b.bucket = malloc(sizeof(uint32_t) * n);
+	b.order = malloc(sizeof(size_t) * n);
+	b.counts = calloc((size_t)nthreads * nthreads, sizeof(size_t));
+	b.part_start = malloc(sizeof(size_t) * (nthreads + 1));
+	workers = calloc(nthreads, sizeof(struct bulk_worker));
+	head = new_buckets(size);
+	if (!b.bucket || !b.order || !b.counts || !b.part_start || !workers ||
+		!head) {
+		free(head);
+		goto out;
+	}
+
+	hash_rehash_finish(table);
+	free(table->head);
+	table->head = head;
+	table->size = size;
+
+	for (t = 0; t < (size_t)nthreads; t++) {
+		workers[t].bulk = &b;
+		workers[t].id = t;
+	}
+
+	bulk_run(workers, nthreads, bulk_hash);
+
+	/* counts[t][p] becomes where thread t scatters into partition p */
+	for (p = 0, off = 0; p < (size_t)nthreads; p++) {
+		b.part_start[p] = off;
+		for (t = 0; t < (size_t)nthreads; t++) {
+			i = b.counts[t * nthreads + p];
+			b.counts[t * nthreads + p] = off;
+			off += i;
+		}
+	}
+	b.part_start[nthreads] = off;
+
+	bulk_run(workers, nthreads, bulk_scatter);
+	bulk_run(workers, nthreads, bulk_link);
+
+	for (t = 0; t < (size_t)nthreads; t++)
+		table->count += workers[t].added;
+	ret = table->count;
+
+out:
+	free(b.bucket);
+	free(b.order);
+	free(b.counts);
+	free(b.part_start);
+	free(workers);
+	return ret;
+}
+
+/*
+ * hash_add_bulk_nodes() for plain keys and values, the nodes come from
+ * the table. Tables without HASH_ARENA take the keys one by one.
+ */
+int hash_add_bulk(struct hash_table *table, void **keys, void **values,
+				  size_t n, int nthreads)
+{
+	struct hash_node *node, *nodes, **ptrs;
+	size_t i;
+	int ret;
+
+	if (table->count)
+		return -1;
+
+	if (!(table->flags & HASH_ARENA) || (table->flags & HASH_OPEN_ADDRESSING)) {
+		for (i = 0; i < n; i++) {
+			if (hash_find(table, keys[i], &node, 1))
+				continue;
+			if (hash_add(table, keys[i], values[i]) < 0)
+				return -1;
+		}
+		return table->count;
+	}
+
+	if (!(nodes = arena_alloc(&table->arena, sizeof(struct hash_node) * n)) ||
+		!(ptrs = malloc(sizeof(struct hash_node *) * (n + 1))))
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		nodes[i].key = keys[i];
+		nodes[i].value = values[i];
+		ptrs[i] = &nodes[i];
+	}
+
+	ret = hash_add_bulk_nodes(table, ptrs, n, nthreads);
+	free(ptrs);
+	return ret;
+}
+
+static struct hash_node *first_in(struct hash_head *head)
+{
+	return hlist_entry_safe(hlist_load_acquire(&head->first),
+							struct hash_node, node);
+}
+
+/*
+ * chained: bucket numbers past table->size index into new_head[]
+ * open addressing: the bucket is the slot number
+ */
+static struct hash_node *iter_scan(struct hash_table *table, struct hash_iter *iter)
+{
+	struct hash_node *pos = NULL;
+	int total = table->size + (hash_is_rehashing(table) ? table->new_size : 0);
+
+	while (!pos && ++iter->bucket < total) {
+		if (table->flags & HASH_OPEN_ADDRESSING) {
+			if (table->ctrl[iter->bucket] >= 0)
+				pos = table->slots + iter->bucket;
+		} else if (iter->bucket < table->size) {
+			pos = first_in(table->head + iter->bucket);
+		} else {
+			pos = first_in(table->new_head + iter->bucket - table->size);
+		}
+	}
+
+	return pos;
+}
+
+struct hash_node *hash_iter_first(struct hash_table *table, struct hash_iter *iter)
+{
+	iter->bucket = -1;
+	iter->next = iter_scan(table, iter);
+	return hash_iter_next(table, iter);
+}
+
+struct hash_node *hash_iter_next(struct hash_table *table, struct hash_iter *iter)
+{
+	struct hash_node *pos = iter->next;
+
+	if (!pos)
+		return NULL;
+
+	if (table->flags & HASH_OPEN_ADDRESSING)
+		iter->next = NULL;
+	else
+		iter->next = hlist_entry_safe(hlist_load_acquire(&pos->node.next),
+									  struct hash_node, node);
+	if (!iter->next)
+		iter->next = iter_scan(table, iter);
+
+	return pos;
+}
+
+static void stats_chain(struct hash_stats *stats, int len)
+{
+	stats->hist[len < HASH_STATS_HIST - 1 ? len : HASH_STATS_HIST - 1]++;
+	if (len > stats->longest)
+		stats->longest = len;
+}
+
+static void stats_buckets(struct hash_stats *stats, struct hash_head *head, int size)
+{
+	struct hash_node *pos;
+	int i, len;
+
+	for (i = 0; i < size; i++) {
+		len = 0;
+		hash_for_each_entry(pos, head + i)
+			len++;
+		stats_chain(stats, len);
+	}
+}
+
+/* groups from the home group of the key in @slot to the slot itself */
+static int oa_probe_len(struct hash_table *table, int slot)
+{
+	int groups = table->size / GROUP_WIDTH;
+	int g = H1(oa_hash(table, table->slots[slot].key)) & (groups - 1);
+	int step = 0, len = 1;
+
+	while (g != slot / GROUP_WIDTH && len <= groups) {
+		g = (g + ++step) & (groups - 1);
+		len++;
+	}
+
+	return len;
+}
+
+/*
+ * A walk over the whole table, it does not change anything so it may
+ * run next to hash_find() callers, but not next to hash_add/hash_del.
+ */
+void hash_stats(struct hash_table *table, struct hash_stats *stats)
 {
 	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->count = table->count;
+
+	if (table->flags & HASH_OPEN_ADDRESSING) {
+		stats->size = table->size;
+		for (i = 0; i < table->size; i++) {
+			if (table->ctrl[i] >= 0)
+				stats_chain(stats, oa_probe_len(table, i));
+		}
+	} else {
+		stats->size = table->size;
+		stats_buckets(stats, table->head, table->size);
+		if (hash_is_rehashing(table)) {
+			stats->size += table->new_size;
+			stats_buckets(stats, table->new_head, table->new_size);
+		}
+	}
+
+	stats->load = stats->size ? (double)stats->count / stats->size : 0;
+
+#ifdef HASH_STATS
+	stats->stats_enabled = 1;
+	stats->lookups = __atomic_load_n(&table->lookups, __ATOMIC_RELAXED);
+	stats->hits = __atomic_load_n(&table->hits, __ATOMIC_RELAXED);
+	stats->misses = __atomic_load_n(&table->misses, __ATOMIC_RELAXED);
+	if (stats->lookups)
+		stats->avg_probe = (double)__atomic_load_n(&table->probes, __ATOMIC_RELAXED) /
+			stats->lookups;
+#endif
+}
+
+void hash_free(struct hash_table *table)
+{
+	struct hash_iter iter;
 	struct hash_node *pos;
-	struct hlist_node *tmp;
 
 	if (!table)
 		return;
 
-	for (i = 0; i < table->size; i++) {
-		hash_for_each_entry_safe(pos, tmp, table->head + i) {
-			hash_del(pos);
+	if (table->flags & HASH_OPEN_ADDRESSING) {
+		free(table->ctrl);
+		free(table->slots);
+	} else {
+		if (!(table->flags & HASH_ARENA)) {
+			hash_for_each(table, &iter, pos) {
+				hlist_del(&pos->node);
+				free(pos);
+			}
 		}
+		free(table->new_head);
+		free(table->head);
 	}
 
-	free(table->head);
+	arena_free(&table->arena);
 	free(table);
 }
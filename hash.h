@@ -1,15 +1,50 @@
 #ifndef _HASH_H_
 #define _HASH_H_
 
+#include <stdint.h>
+#include <stddef.h>
+
 #include "list.h"
+#include "arena.h"
 
 #define HASH_KEY_TYPE_INT	1
 #define HASH_KEY_TYPE_STR	2
 
+/* hash_init() flags */
+#define HASH_OPEN_ADDRESSING	0x01	/* SwissTable style probing, no chains */
+#define HASH_ARENA				0x02	/* nodes come from a table owned arena */
+#define HASH_LEGACY				0x04	/* unseeded byte at a time hash of old */
+
+/* grow when count / size goes over this, shrink when it drops under 1/8 */
+#define HASH_MAX_LOAD		2
+#define HASH_MIN_LOAD_DIV	8
+/* buckets moved to the new table per hash_add/hash_find call */
+#define HASH_REHASH_STEP	1
+/* lookups hash_find_many() keeps in flight at once */
+#define HASH_BATCH		16
+/* chain lengths 0 .. HASH_STATS_HIST - 2, the last slot counts longer ones */
+#define HASH_STATS_HIST		8
+
 #define hash_for_each_entry(pos, head) hlist_for_each_entry(pos, head, node)
 #define hash_for_each_entry_safe(pos, n, head) hlist_for_each_entry_safe(pos, n, head, node)
+/* lookups, which may run while hash_add_node_live() links a node in */
+#define hash_for_each_entry_acquire(pos, head) hlist_for_each_entry_acquire(pos, head, node)
 #define hash_head hlist_head
 
+/*
+ * hash_for_each - iterate over every node of the table
+ * @table:	the hash table
+ * @iter:	a struct hash_iter * used as cursor
+ * @pos:	the struct hash_node * to use as a loop cursor
+ *
+ * It is safe to hash_del() @pos, but not to hash_add() inside the loop.
+ */
+#define hash_for_each(table, iter, pos) \
+	for (pos = hash_iter_first(table, iter); pos; pos = hash_iter_next(table, iter))
+
+/* hashes @len bytes at @key */
+typedef uint64_t (*hash_fn_t)(const void *key, size_t len, uint64_t seed);
+
 struct hash_node {
 	void *key;
 	void *value;
@@ -17,16 +52,93 @@ struct hash_node {
 };
 
 struct hash_table {
-	int size;
+	int size;			/* buckets, or slots with HASH_OPEN_ADDRESSING */
 	int key_type;
+	int flags;
+	int count;
+	int min_size;
 	struct hash_head *head;
+	/*
+	 * while rehashing, buckets of head[] below rehash_idx have been moved
+	 * into new_head[], new nodes always go into new_head[].
+	 */
+	int new_size;
+	int rehash_idx;
+	struct hash_head *new_head;
+	/* HASH_OPEN_ADDRESSING: size control bytes and slots */
+	int8_t *ctrl;
+	struct hash_node *slots;
+	int growth_left;
+	hash_fn_t hash_fn;
+	uint64_t seed;		/* random unless hash_set_fn() says otherwise */
+	/* HASH_ARENA: released as a whole by hash_free() */
+	struct arena arena;
+	/* hash_find() totals, only counted when built with -DHASH_STATS */
+	unsigned long lookups;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long probes;
+};
+
+/*
+ * hist[] counts buckets by chain length. With HASH_OPEN_ADDRESSING it
+ * counts keys by the number of groups their probe sequence visits before
+ * reaching them, and probes are groups instead of nodes.
+ */
+struct hash_stats {
+	int count;
+	int size;			/* buckets or slots, both tables while rehashing */
+	double load;		/* count / size */
+	int longest;
+	int hist[HASH_STATS_HIST];
+	int stats_enabled;	/* the counters below are kept (-DHASH_STATS) */
+	unsigned long lookups;
+	unsigned long hits;
+	unsigned long misses;
+	double avg_probe;	/* per lookup */
+};
+
+struct hash_iter {
+	int bucket;
+	struct hash_node *next;
 };
 
-struct hash_table *hash_init(int size, int key_type);
+struct hash_table *hash_init(int size, int key_type, int flags);
+int hash_set_fn(struct hash_table *table, hash_fn_t fn, uint64_t seed);
+uint64_t hash_wyhash(const void *key, size_t len, uint64_t seed);
 int hash_add(struct hash_table *table, void *key, void *value);
+int hash_add_node(struct hash_table *table, struct hash_node *node);
+int hash_add_node_live(struct hash_table *table, struct hash_node *node);
+int hash_add_bulk(struct hash_table *table, void **keys, void **values,
+				  size_t n, int nthreads);
+int hash_add_bulk_nodes(struct hash_table *table, struct hash_node **nodes,
+						size_t n, int nthreads);
 int hash_find(struct hash_table *table, const void *key,
 			  struct hash_node **node, size_t size);
-void hash_del(struct hash_node *node);
+size_t hash_find_many(struct hash_table *table, const void **keys, size_t n,
+					  struct hash_node **nodes);
+void hash_del(struct hash_table *table, struct hash_node *node);
 void hash_free(struct hash_table *table);
+void hash_rehash_finish(struct hash_table *table);
+void hash_stats(struct hash_table *table, struct hash_stats *stats);
+struct hash_node *hash_iter_first(struct hash_table *table, struct hash_iter *iter);
+struct hash_node *hash_iter_next(struct hash_table *table, struct hash_iter *iter);
+
+/* the table's arena, callers may put their own data in it as well */
+static inline struct arena *hash_arena(struct hash_table *table)
+{
+	return (table->flags & HASH_ARENA) ? &table->arena : NULL;
+}
+
+static inline int hash_is_rehashing(const struct hash_table *table)
+{
+	return table->rehash_idx >= 0;
+}
+
+/* one more node fits without starting a resize, see hash_add_node_live() */
+static inline int hash_has_room(const struct hash_table *table)
+{
+	return !hash_is_rehashing(table) && table->count < table->size * HASH_MAX_LOAD;
+}
 
 #endif /* _HASH_H_ */
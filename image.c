@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image.h"
+#include "file.h"
+#include "debug.h"
+
+#define ALIGN8(x)	(((x) + 7) & ~(uint64_t)7)
+
+/* FNV-1a, fixed so that images are portable between processes */
+static uint32_t image_hash(const char *str)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/* word at a time, @len is a multiple of 8 */
+static uint64_t image_checksum(const void *data, size_t len)
+{
+	const uint64_t *p = data;
+	uint64_t sum = 0x9e3779b97f4a7c15ULL;
+	size_t i;
+
+	for (i = 0; i < len / 8; i++) {
+		sum = (sum ^ p[i]) * 0x100000001b3ULL;
+		sum ^= sum >> 29;
+	}
+
+	return sum;
+}
+
+void image_builder_init(struct image_builder *b)
+{
+	b->names = NULL;
+	b->values = NULL;
+	b->count = b->alloc = 0;
+}
+
+/* the strings are not copied, they have to outlive image_builder_write() */
+int image_builder_add(struct image_builder *b, const char *name, const char *value)
+{
+	const char **names, **values;
+	size_t alloc;
+
+	if (b->count == b->alloc) {
+		alloc = b->alloc ? b->alloc * 2 : 64;
+		if (!(names = realloc(b->names, alloc * sizeof(char *))))
+			return -1;
+		b->names = names;
+		if (!(values = realloc(b->values, alloc * sizeof(char *))))
+			return -1;
+		b->values = values;
+		b->alloc = alloc;
+	}
+
+	b->names[b->count] = name;
+	b->values[b->count] = value;
+	b->count++;
+
+	return 0;
+}
+
+/*
+ * the image is written next to @filename and renamed over it, so
+ * processes that still map the old one keep a consistent copy.
+ */
+int image_builder_write(struct image_builder *b, const char *filename)
+{
+	size_t i, len;
+	uint64_t nslots, pool_len, slot, off;
+	uint32_t hash;
+	char *buf, *pool;
+	struct image_header *hdr;
+	struct image_entry *entries;
+	uint32_t *index;
+	struct iovec iov;
+	int ret;
+
+	for (nslots = 16; nslots < b->count * 2; nslots <<= 1)
+		;
+
+	pool_len = 0;
+	for (i = 0; i < b->count; i++)
+		pool_len += strlen(b->names[i]) + strlen(b->values[i]) + 2;
+	pool_len = ALIGN8(pool_len);
+
+	len = sizeof(struct image_header);
+	len += b->count * sizeof(struct image_entry);
+	len += ALIGN8(nslots * sizeof(uint32_t));
+	len += pool_len;
+
+	if (!(buf = calloc(1, len)))
+		return -1;
+
+	hdr = (struct image_header *)buf;
+	memcpy(hdr->magic, IMAGE_MAGIC, sizeof(hdr->magic));
+	hdr->version = IMAGE_VERSION;
+	hdr->header_size = sizeof(struct image_header);
+	hdr->count = b->count;
+	hdr->nslots = nslots;
+	hdr->entries_off = sizeof(struct image_header);
+	hdr->index_off = hdr->entries_off + b->count * sizeof(struct image_entry);
+	hdr->pool_off = hdr->index_off + ALIGN8(nslots * sizeof(uint32_t));
+	hdr->pool_len = pool_len;
+	hdr->file_size = len;
+
+	entries = (struct image_entry *)(buf + hdr->entries_off);
+	index = (uint32_t *)(buf + hdr->index_off);
+	pool = buf + hdr->pool_off;
+
+	off = 0;
+	for (i = 0; i < b->count; i++) {
+		hash = image_hash(b->names[i]);
+		entries[i].hash = hash;
+		entries[i].name_len = strlen(b->names[i]);
+		entries[i].name_off = off;
+		memcpy(pool + off, b->names[i], entries[i].name_len + 1);
+		off += entries[i].name_len + 1;
+		entries[i].value_off = off;
+		strcpy(pool + off, b->values[i]);
+		off += strlen(b->values[i]) + 1;
+
+		for (slot = hash & (nslots - 1); index[slot]; slot = (slot + 1) & (nslots - 1))
+			;
+		index[slot] = i + 1;
+	}
+
+	hdr->body_sum = image_checksum(buf + sizeof(*hdr), len - sizeof(*hdr));
+	hdr->header_sum = image_checksum(hdr, offsetof(struct image_header, header_sum));
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	ret = file_replace(filename, &iov, 1);
+
+	free(buf);
+	return ret;
+}
+
+void image_builder_free(struct image_builder *b)
+{
+	free(b->names);
+	free(b->values);
+	image_builder_init(b);
+}
+
+/* [@off, @off + @len) lies within @size bytes */
+static int image_extent_ok(uint64_t off, uint64_t len, uint64_t size)
+{
+	return off <= size && len <= size - off;
+}
+
+/*
+ * The layout the header describes has to fit the file and be usable by
+ * image_lookup() even without @verify: every table in bounds, a power of
+ * two index with at least one empty slot, a NUL terminated pool.
+ */
+static int image_layout_ok(const struct image_header *hdr, uint64_t size)
+{
+	if (hdr->count > size / sizeof(struct image_entry) ||
+		hdr->nslots > size / sizeof(uint32_t))
+		return 0;
+
+	if (!hdr->nslots || (hdr->nslots & (hdr->nslots - 1)) ||
+		hdr->count >= hdr->nslots)
+		return 0;
+
+	if (hdr->entries_off % 8 || hdr->index_off % 4 ||
+		!image_extent_ok(hdr->entries_off,
+						 hdr->count * sizeof(struct image_entry), size) ||
+		!image_extent_ok(hdr->index_off, hdr->nslots * sizeof(uint32_t), size) ||
+		!image_extent_ok(hdr->pool_off, hdr->pool_len, size))
+		return 0;
+
+	return !hdr->pool_len ||
+		((const char *)hdr)[hdr->pool_off + hdr->pool_len - 1] == '\0';
+}
+
+/*
+ * Only the header is checked by default, which keeps opening O(1); with
+ * @verify the whole body is checksummed as well. Corrupt offsets in the
+ * body are caught by image_lookup() and image_str() as they are used.
+ */
+int image_open(struct image *img, const char *filename, int verify)
+{
+	int fd;
+	struct stat st;
+	const struct image_header *hdr;
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct image_header)) {
+		close(fd);
+		return -1;
+	}
+
+	img->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (img->map == MAP_FAILED)
+		return -1;
+	img->len = st.st_size;
+
+	hdr = img->hdr = (const struct image_header *)img->map;
+	if (memcmp(hdr->magic, IMAGE_MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->version != IMAGE_VERSION ||
+		hdr->header_size != sizeof(struct image_header) ||
+		hdr->header_sum != image_checksum(hdr, offsetof(struct image_header, header_sum))) {
+		debug("%s: not a config image", filename);
+		goto bad;
+	}
+
+	if (hdr->file_size != img->len) {
+		debug("%s: truncated image", filename);
+		goto bad;
+	}
+
+	if (!image_layout_ok(hdr, img->len)) {
+		debug("%s: corrupt image layout", filename);
+		goto bad;
+	}
+
+	if (verify && hdr->body_sum != image_checksum(img->map + sizeof(*hdr),
+												   img->len - sizeof(*hdr))) {
+		debug("%s: checksum mismatch", filename);
+		goto bad;
+	}
+
+	img->entries = (const struct image_entry *)(img->map + hdr->entries_off);
+	img->index = (const uint32_t *)(img->map + hdr->index_off);
+	img->pool = img->map + hdr->pool_off;
+
+	return 0;
+
+bad:
+	munmap((void *)img->map, img->len);
+	img->map = NULL;
+	return -1;
+}
+
+/* at most nslots probes, a corrupt index can be full or point anywhere */
+const char *image_lookup(const struct image *img, const char *name)
+{
+	uint32_t hash = image_hash(name);
+	uint64_t mask = img->hdr->nslots - 1;
+	uint64_t slot, n;
+	const struct image_entry *entry;
+
+	for (slot = hash & mask, n = 0; img->index[slot] && n <= mask;
+		 slot = (slot + 1) & mask, n++) {
+		if (img->index[slot] > img->hdr->count)
+			return NULL;
+		entry = img->entries + img->index[slot] - 1;
+		if (entry->hash == hash &&
+			strcmp(image_str(img, entry->name_off), name) == 0)
+			return image_str(img, entry->value_off);
+	}
+
+	return NULL;
+}
+
+void image_close(struct image *img)
+{
+	if (img->map)
+		munmap((void *)img->map, img->len);
+	img->map = NULL;
+}
@@ -0,0 +1,88 @@
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * compiled config image, all integers in host byte order:
+ *
+ *   struct image_header
+ *   struct image_entry entries[count]
+ *   uint32_t index[nslots]		entry number + 1, 0 is an empty slot
+ *   char pool[pool_len]		NUL terminated names and values
+ *
+ * The index is linear probing on image_hash(name) & (nslots - 1).
+ */
+#define IMAGE_MAGIC		"CFGIMG\0\0"
+#define IMAGE_VERSION	1
+
+struct image_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t count;
+	uint64_t nslots;
+	uint64_t entries_off;
+	uint64_t index_off;
+	uint64_t pool_off;
+	uint64_t pool_len;
+	uint64_t file_size;
+	uint64_t body_sum;		/* image_checksum() of everything after the header */
+	uint64_t header_sum;	/* image_checksum() of the header up to here */
+};
+
+struct image_entry {
+	uint64_t name_off;
+	uint64_t value_off;
+	uint32_t name_len;
+	uint32_t hash;
+};
+
+struct image {
+	const char *map;
+	size_t len;
+	const struct image_header *hdr;
+	const struct image_entry *entries;
+	const uint32_t *index;
+	const char *pool;
+};
+
+struct image_builder {
+	const char **names;
+	const char **values;
+	size_t count;
+	size_t alloc;
+};
+
+void image_builder_init(struct image_builder *b);
+int image_builder_add(struct image_builder *b, const char *name, const char *value);
+int image_builder_write(struct image_builder *b, const char *filename);
+void image_builder_free(struct image_builder *b);
+
+int image_open(struct image *img, const char *filename, int verify);
+const char *image_lookup(const struct image *img, const char *name);
+void image_close(struct image *img);
+
+static inline size_t image_count(const struct image *img)
+{
+	return img->hdr->count;
+}
+
+/* the string at @off in the pool, "" for an offset past it */
+static inline const char *image_str(const struct image *img, uint64_t off)
+{
+	return off < img->hdr->pool_len ? img->pool + off : "";
+}
+
+static inline const char *image_name(const struct image *img, size_t i)
+{
+	return image_str(img, img->entries[i].name_off);
+}
+
+static inline const char *image_value(const struct image *img, size_t i)
+{
+	return image_str(img, img->entries[i].value_off);
+}
+
+#endif /* _IMAGE_H_ */
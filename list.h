@@ -722,6 +722,31 @@ static inline void hlist_move_list(struct hlist_head *old,
 			pos;							\
 			pos = hlist_entry_safe((pos)->member.next, typeof(*(pos)), member))
 
+/**
+ * hlist_load_acquire - load a ->first or ->next a writer may be storing
+ * @ptr:	&head->first or &node->next
+ *
+ * Pairs with a release store of the link, so a node reached through it
+ * is seen whole.
+ */
+#define hlist_load_acquire(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+
+/**
+ * hlist_for_each_entry_acquire - iterate over a hlist another thread adds to
+ * @pos:	the type * to use as a loop cursor.
+ * @head:	the head for your list.
+ * @member:	the name of the hlist_node within the struct.
+ *
+ * Safe against a concurrent writer that links nodes in with release
+ * stores; not against deletion.
+ */
+#define hlist_for_each_entry_acquire(pos, head, member)			\
+	for (pos = hlist_entry_safe(hlist_load_acquire(&(head)->first),	\
+				typeof(*(pos)), member);			\
+			pos;							\
+			pos = hlist_entry_safe(hlist_load_acquire(&(pos)->member.next), \
+				typeof(*(pos)), member))
+
 /**
  * hlist_for_each_entry_continue - iterate over a hlist continuing after current point
  * @pos:	the type * to use as a loop cursor.
@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "mph.h"
+#include "debug.h"
+
+static uint64_t mix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint64_t mph_hash(const char *key, uint64_t salt)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL ^ salt;
+
+	while (*key) {
+		hash ^= (unsigned char)*key++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return mix64(hash);
+}
+
+/* map a 32 bit value onto [0, n) without a division */
+static uint32_t reduce(uint32_t x, uint32_t n)
+{
+	return ((uint64_t)x * n) >> 32;
+}
+
+static uint32_t mph_bucket(const struct mph *mph, uint64_t hash)
+{
+	return reduce(hash >> 32, mph->nbuckets);
+}
+
+static uint32_t mph_slot(const struct mph *mph, uint64_t hash, int32_t seed)
+{
+	if (seed < 0)
+		return -seed - 1;
+	return reduce(mix64(hash + (uint64_t)seed * 0x9e3779b97f4a7c15ULL), mph->n);
+}
+
+struct bucket {
+	uint32_t id;
+	uint32_t size;
+	uint32_t first;		/* into the key order array */
+};
+
+static int bucket_cmp(const void *a, const void *b)
+{
+	const struct bucket *x = a, *y = b;
+
+	return (int)y->size - (int)x->size;
+}
+
+static int try_build(struct mph *mph, uint64_t *hashes, uint32_t *order,
+					 struct bucket *buckets, uint8_t *taken,
+					 uint32_t *slots)
+{
+	uint32_t i, j, k, b, free_slot;
+	int32_t seed;
+
+	memset(taken, 0, mph->n);
+
+	for (b = 0; b < mph->nbuckets && buckets[b].size > 1; b++) {
+		for (seed = 0; seed < MPH_MAX_SEED; seed++) {
+			for (j = 0; j < buckets[b].size; j++) {
+				slots[j] = mph_slot(mph, hashes[order[buckets[b].first + j]], seed);
+				if (taken[slots[j]])
+					break;
+				for (k = 0; k < j && slots[k] != slots[j]; k++)
+					;
+				if (k < j)
+					break;
+			}
+			if (j == buckets[b].size)
+				break;
+		}
+		if (seed == MPH_MAX_SEED)
+			return -1;
+
+		mph->seeds[buckets[b].id] = seed;
+		for (j = 0; j < buckets[b].size; j++)
+			taken[slots[j]] = 1;
+	}
+
+	/* singletons take the remaining slots in order */
+	free_slot = 0;
+	for (; b < mph->nbuckets && buckets[b].size == 1; b++) {
+		while (taken[free_slot])
+			free_slot++;
+		taken[free_slot] = 1;
+		mph->seeds[buckets[b].id] = -(int32_t)free_slot - 1;
+	}
+
+	for (i = b; i < mph->nbuckets; i++)
+		mph->seeds[buckets[i].id] = 0;
+
+	return 0;
+}
+
+/*
+ * Keys must be distinct. The key and value pointers are stored as they
+ * are, they have to outlive the mph.
+ */
+int mph_build(struct mph *mph, const char **keys, void **values, uint32_t n)
+{
+	uint32_t i, b, attempt, *order = NULL, *fill = NULL, slots[256];
+	uint64_t *hashes = NULL;
+	struct bucket *buckets = NULL;
+	uint8_t *taken = NULL;
+	int ret = -1;
+
+	memset(mph, 0, sizeof(*mph));
+	mph->n = n;
+	mph->nbuckets = n / MPH_BUCKET_KEYS + 1;
+
+	if (!(mph->seeds = malloc(sizeof(int32_t) * mph->nbuckets)) ||
+		!(mph->entries = malloc(sizeof(struct mph_entry) * (n ? n : 1))) ||
+		!(hashes = malloc(sizeof(uint64_t) * (n ? n : 1))) ||
+		!(order = malloc(sizeof(uint32_t) * (n ? n : 1))) ||
+		!(fill = malloc(sizeof(uint32_t) * mph->nbuckets)) ||
+		!(buckets = malloc(sizeof(struct bucket) * mph->nbuckets)) ||
+		!(taken = malloc(n ? n : 1)))
+		goto out;
+
+	for (attempt = 0; attempt < 16; attempt++) {
+		mph->salt = mix64(attempt + 1);
+
+		for (b = 0; b < mph->nbuckets; b++) {
+			buckets[b].id = b;
+			buckets[b].size = 0;
+		}
+		for (i = 0; i < n; i++) {
+			hashes[i] = mph_hash(keys[i], mph->salt);
+			buckets[mph_bucket(mph, hashes[i])].size++;
+		}
+
+		/* counting sort of the keys by bucket */
+		for (i = 0, b = 0; b < mph->nbuckets; b++) {
+			buckets[b].first = fill[b] = i;
+			i += buckets[b].size;
+		}
+		for (i = 0; i < n; i++)
+			order[fill[mph_bucket(mph, hashes[i])]++] = i;
+
+		qsort(buckets, mph->nbuckets, sizeof(struct bucket), bucket_cmp);
+		if (buckets[0].size > sizeof(slots) / sizeof(slots[0]))
+			continue;
+
+		if (try_build(mph, hashes, order, buckets, taken, slots) == 0)
+			break;
+		debug("mph: retrying with another salt");
+	}
+	if (attempt == 16)
+		goto out;
+
+	for (i = 0; i < n; i++) {
+		b = mph_slot(mph, hashes[i], mph->seeds[mph_bucket(mph, hashes[i])]);
+		mph->entries[b].key = keys[i];
+		mph->entries[b].value = values[i];
+	}
+	ret = 0;
+
+out:
+	free(hashes);
+	free(order);
+	free(fill);
+	free(buckets);
+	free(taken);
+	if (ret < 0)
+		mph_free(mph);
+	return ret;
+}
+
+/* one hash, one seed, one entry and one key compare */
+void *mph_lookup(const struct mph *mph, const char *key)
+{
+	uint64_t hash;
+	const struct mph_entry *entry;
+
+	if (mph->n == 0)
+		return NULL;
+
+	hash = mph_hash(key, mph->salt);
+	entry = mph->entries + mph_slot(mph, hash, mph->seeds[mph_bucket(mph, hash)]);
+
+	return strcmp(entry->key, key) == 0 ? entry->value : NULL;
+}
+
+void mph_free(struct mph *mph)
+{
+	free(mph->seeds);
+	free(mph->entries);
+	mph->seeds = NULL;
+	mph->entries = NULL;
+	mph->n = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef _MPH_H_
+#define _MPH_H_
+
+#include <stdint.h>
+
+/* average number of keys per displacement bucket */
+#define MPH_BUCKET_KEYS		4
+/* give up on a bucket after this many seeds and retry with another salt */
+#define MPH_MAX_SEED		(1 << 16)
+
+struct mph_entry {
+	const char *key;
+	void *value;
+};
+
+/*
+ * minimal perfect hash over a fixed key set, CHD style: keys are first
+ * hashed into buckets, and each bucket stores the seed that sends all
+ * of its keys to free slots of the n entry array. Singleton buckets are
+ * placed last, directly into whatever slots are left (stored as a
+ * negative seed), which keeps building fast at load factor 1.
+ */
+struct mph {
+	uint32_t n;
+	uint32_t nbuckets;
+	uint64_t salt;
+	int32_t *seeds;
+	struct mph_entry *entries;
+};
+
+int mph_build(struct mph *mph, const char **keys, void **values, uint32_t n);
+void *mph_lookup(const struct mph *mph, const char *key);
+void mph_free(struct mph *mph);
+
+#endif /* _MPH_H_ */
@@ -0,0 +1,117 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+#include "scan.h"
+
+#define IS_SPECIAL(c, delim) \
+	((c) == '\n' || (c) == '"' || (c) == ' ' || (c) == (delim) || (c) == '\0')
+
+static const char *scan_special_scalar(const char *p, const char *end, char delim)
+{
+	for (; p < end; p++) {
+		if (IS_SPECIAL(*p, delim))
+			return p;
+	}
+	return end;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static const char *scan_special_sse2(const char *p, const char *end, char delim)
+{
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i dl = _mm_set1_epi8(delim);
+	const __m128i nul = _mm_setzero_si128();
+	__m128i v, hit;
+	uint32_t mask;
+
+	for (; end - p >= 16; p += 16) {
+		v = _mm_loadu_si128((const __m128i *)p);
+		hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, nl),
+										_mm_cmpeq_epi8(v, quote)),
+						   _mm_or_si128(_mm_cmpeq_epi8(v, space),
+										_mm_or_si128(_mm_cmpeq_epi8(v, dl),
+													 _mm_cmpeq_epi8(v, nul))));
+		if ((mask = _mm_movemask_epi8(hit)))
+			return p + __builtin_ctz(mask);
+	}
+
+	return scan_special_scalar(p, end, delim);
+}
+
+__attribute__((target("avx2")))
+static const char *scan_special_avx2(const char *p, const char *end, char delim)
+{
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i space = _mm256_set1_epi8(' ');
+	const __m256i dl = _mm256_set1_epi8(delim);
+	const __m256i nul = _mm256_setzero_si256();
+	__m256i v, hit;
+	uint32_t mask;
+
+	for (; end - p >= 32; p += 32) {
+		v = _mm256_loadu_si256((const __m256i *)p);
+		hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, nl),
+											  _mm256_cmpeq_epi8(v, quote)),
+							  _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+											  _mm256_or_si256(_mm256_cmpeq_epi8(v, dl),
+															  _mm256_cmpeq_epi8(v, nul))));
+		if ((mask = _mm256_movemask_epi8(hit)))
+			return p + __builtin_ctz(mask);
+	}
+
+	return scan_special_sse2(p, end, delim);
+}
+#endif
+
+/*
+ * picks an implementation by what the CPU supports, at startup so that
+ * threads never race on the pointer.
+ */
+__attribute__((constructor))
+static void scan_init(void)
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		scan_special = scan_special_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		scan_special = scan_special_sse2;
+	else
+		scan_special = scan_special_scalar;
+#else
+	scan_special = scan_special_scalar;
+#endif
+}
+
+/* only used if a constructor calls in before scan_init() ran */
+static const char *scan_special_resolve(const char *p, const char *end, char delim)
+{
+	scan_init();
+	return scan_special(p, end, delim);
+}
+
+scan_fn_t scan_special = scan_special_resolve;
+
+/* lets the tests run every implementation against the others */
+scan_fn_t scan_impl(const char *name)
+{
+	if (!strcmp(name, "scalar"))
+		return scan_special_scalar;
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (!strcmp(name, "sse2") && __builtin_cpu_supports("sse2"))
+		return scan_special_sse2;
+	if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))
+		return scan_special_avx2;
+#endif
+	return NULL;
+}
@@ -0,0 +1,20 @@
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+/*
+ * scan_special - find the next byte parse_line() has to look at
+ * @p:		start of the scan
+ * @end:	end of the buffer, never read
+ * @delim:	the name/value delimiter
+ *
+ * @return: the first of '\n', '"', ' ', @delim or '\0' in [p, end), or
+ *          @end if there is none.
+ */
+typedef const char *(*scan_fn_t)(const char *p, const char *end, char delim);
+
+extern scan_fn_t scan_special;
+
+/* "scalar", "sse2" or "avx2", NULL if this build or CPU lacks it */
+scan_fn_t scan_impl(const char *name);
+
+#endif /* _SCAN_H_ */
@@ -0,0 +1,201 @@
+/*
+ * cfg_set_value() links new keys into the published table, and into
+ * their section, while readers walk them without a lock. Reader threads
+ * look up every key the writer has added so far, by name, in batches, by
+ * resolved key and under its section, and walk the sections; they must
+ * always find the keys whole.
+ *
+ * Build it with -fsanitize=thread (see the Makefile) to have every load
+ * on the lookup path checked against the writer's stores.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "config.h"
+
+#define NKEYS		100000
+#define NREADERS	4
+#define NRESOLVED	16
+#define NBATCH		8
+/* odd keys go to section i % NSECTIONS, loaded with one key each */
+#define NSECTIONS	5
+
+static config_t *cfg;
+static config_key_t resolved[NRESOLVED];
+/* keys 0 .. added - 1 are in */
+static int added;
+static int done;
+
+static void key_name(char *buf, size_t size, int i)
+{
+	if (i % 2)
+		snprintf(buf, size, "s%d.k%d", i % NSECTIONS, i);
+	else
+		snprintf(buf, size, "k%d", i);
+}
+
+static void key_value(char *buf, size_t size, int i)
+{
+	snprintf(buf, size, "value of k%d", i);
+}
+
+/* resolved[j] is the name of key j * (NKEYS / NRESOLVED) */
+static int resolved_index(int j)
+{
+	return j * (NKEYS / NRESOLVED);
+}
+
+static int check(const char *value, int i)
+{
+	char want[32];
+
+	key_value(want, sizeof(want), i);
+	return value && !strcmp(value, want) ? 0 : 1;
+}
+
+/* odd keys below @n in section @sec: those with i % (2 * NSECTIONS) == r */
+static int section_count(int sec, int n)
+{
+	int r = sec % 2 ? sec : sec + NSECTIONS;
+
+	return n > r ? (n - r + 2 * NSECTIONS - 1) / (2 * NSECTIONS) : 0;
+}
+
+static long check_section(int sec, int n)
+{
+	config_section_iter_t iter;
+	const char *name, *value;
+	char buf[16];
+	long bad = 0;
+	int keys = 0;
+
+	snprintf(buf, sizeof(buf), "s%d", sec);
+	if (cfg_section_iter(cfg, &iter, buf) < 0)
+		return 1;
+	while (config_section_next(&iter, &name, &value)) {
+		if (name[0] != 'k')
+			continue;
+		bad += check(value, atoi(name + 1));
+		keys++;
+	}
+
+	return bad + (keys < section_count(sec, n));
+}
+
+static void *reader(void *arg)
+{
+	unsigned seed = (unsigned long)arg;
+	char names[NBATCH][32], *values[NBATCH], sec[16], leaf[16];
+	const char *ptrs[NBATCH];
+	int idx[NBATCH];
+	long bad = 0, rounds = 0;
+	int n, i, j;
+
+	while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+		if (!(n = __atomic_load_n(&added, __ATOMIC_ACQUIRE)))
+			continue;
+
+		config_read_lock();
+
+		i = rand_r(&seed) % n;
+		key_name(names[0], sizeof(names[0]), i);
+		bad += check(cfg_get_value(cfg, names[0]), i);
+
+		i |= 1;
+		if (i < n) {
+			snprintf(sec, sizeof(sec), "s%d", i % NSECTIONS);
+			snprintf(leaf, sizeof(leaf), "k%d", i);
+			bad += check(cfg_get_section_value(cfg, sec, leaf), i);
+		}
+
+		for (j = 0; j < NBATCH; j++) {
+			idx[j] = rand_r(&seed) % n;
+			key_name(names[j], sizeof(names[j]), idx[j]);
+			ptrs[j] = names[j];
+		}
+		cfg_get_values(cfg, ptrs, NBATCH, values);
+		for (j = 0; j < NBATCH; j++)
+			bad += check(values[j], idx[j]);
+
+		for (j = 0; j < NRESOLVED && resolved_index(j) < n; j++)
+			bad += check(cfg_get_by_key(cfg, resolved[j]), resolved_index(j));
+
+		if (!(++rounds % 256))
+			bad += check_section(rand_r(&seed) % NSECTIONS, n);
+
+		config_read_unlock();
+	}
+
+	return (void *)bad;
+}
+
+/* the sections, so new "s<n>.k<i>" keys have one to go to */
+static int load_sections(const char *path)
+{
+	FILE *fp;
+	int i;
+
+	if (!(fp = fopen(path, "w")))
+		return -1;
+	for (i = 0; i < NSECTIONS; i++)
+		fprintf(fp, "[s%d]\nfirst = %d\n", i, i);
+	if (fclose(fp) < 0)
+		return -1;
+
+	return cfg_load(cfg, path);
+}
+
+int main(void)
+{
+	char path[] = "/tmp/config-test-live-XXXXXX";
+	pthread_t threads[NREADERS];
+	char name[32], value[32];
+	void *ret;
+	long bad = 0;
+	int i, n, fd;
+
+	cfg = config_open();
+	if ((fd = mkstemp(path)) < 0 || close(fd) < 0 || load_sections(path) < 0) {
+		perror("test_live: loading sections");
+		return 1;
+	}
+	unlink(path);
+
+	for (i = 0; i < NRESOLVED; i++) {
+		key_name(name, sizeof(name), resolved_index(i));
+		resolved[i] = cfg_resolve(cfg, name);
+	}
+
+	for (i = 0; i < NREADERS; i++)
+		pthread_create(&threads[i], NULL, reader, (void *)(long)(i + 1));
+
+	for (i = 0; i < NKEYS; i++) {
+		key_name(name, sizeof(name), i);
+		key_value(value, sizeof(value), i);
+		if (cfg_set_value(cfg, name, value) < 0) {
+			fprintf(stderr, "test_live: cannot set %s\n", name);
+			bad++;
+			break;
+		}
+		__atomic_store_n(&added, i + 1, __ATOMIC_RELEASE);
+	}
+
+	n = i;
+	__atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < NREADERS; i++) {
+		pthread_join(threads[i], &ret);
+		bad += (long)ret;
+	}
+
+	for (i = 0; i < NSECTIONS; i++)
+		bad += check_section(i, n);
+
+	printf("%d keys added under %d readers, %ld bad reads\n", n, NREADERS, bad);
+	config_close(cfg);
+
+	printf("test_live: %s\n", bad ? "FAILED" : "ok");
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,367 @@
+/*
+ * Differential test of the vectorized line scanning against the byte at
+ * a time parser it replaced.
+ *
+ * First every scan_special() implementation the CPU has is run against a
+ * plain byte loop, with the stop bytes at every offset around the 16 and
+ * 32 byte blocks and the buffer ending right before an unmapped page.
+ * Then random configs are loaded with each implementation through
+ * cfg_load(), cfg_load_mmap() and the push parser fed in random pieces,
+ * and the keys must come out as the old parser read them.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "scan.h"
+#include "config.h"
+
+#define SCAN_MAX_LEN	96
+#define NFILES			300
+#define MAX_LINES		200
+#define MAX_TOKEN		80
+
+static const char *const impl_names[] = { "scalar", "sse2", "avx2" };
+#define NR_IMPLS		(sizeof(impl_names) / sizeof(impl_names[0]))
+
+static uint64_t rng_state = 0x2545f4914f6cdd1dULL;
+
+static uint64_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static const char *ref_special(const char *p, const char *end, char delim)
+{
+	for (; p < end; p++) {
+		if (*p == '\n' || *p == '"' || *p == ' ' || *p == delim || *p == '\0')
+			return p;
+	}
+	return end;
+}
+
+/*
+ * Buffers of every length up to SCAN_MAX_LEN end at a page that is not
+ * mapped, so a scanner reading past @end faults. Each gets at most one
+ * stop byte, at every position, or none.
+ */
+static int test_scanner(scan_fn_t fn, const char *name)
+{
+	static const char stops[] = { '\n', '"', ' ', '=', ':', '\0' };
+	static const char delims[] = { '=', ':' };
+	long page = sysconf(_SC_PAGESIZE);
+	char *map, *end, *p;
+	int len, pos, s, d, bad = 0;
+	long checks = 0;
+
+	map = mmap(NULL, page * 2, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED || mprotect(map + page, page, PROT_NONE) < 0) {
+		perror("test_scan: guard page");
+		return 1;
+	}
+	end = map + page;
+
+	for (len = 0; len <= SCAN_MAX_LEN; len++) {
+		p = end - len;
+		for (d = 0; d < (int)sizeof(delims); d++) {
+			for (s = 0; s < (int)sizeof(stops); s++) {
+				for (pos = -1; pos < len; pos++) {
+					memset(p, 'a', len);
+					if (pos >= 0)
+						p[pos] = stops[s];
+					if (fn(p, end, delims[d]) != ref_special(p, end, delims[d])) {
+						if (bad++ < 10)
+							fprintf(stderr, "%s: len %d, '%c' at %d, delim '%c'\n",
+									name, len, stops[s], pos, delims[d]);
+					}
+					checks++;
+				}
+			}
+
+			/* random bytes with stop bytes sprinkled in */
+			for (pos = 0; pos < 64; pos++) {
+				for (s = 0; s < len; s++)
+					p[s] = (rng() % 8) ? 'a' + rng() % 26 : stops[rng() % sizeof(stops)];
+				if (fn(p, end, delims[d]) != ref_special(p, end, delims[d]))
+					bad++;
+				checks++;
+			}
+		}
+	}
+
+	munmap(map, page * 2);
+	printf("scan %-6s %ld checks, %d bad\n", name, checks, bad);
+	return bad;
+}
+
+/*
+ * The parser this tree started with, one byte at a time over a line
+ * read by fgets(). First occurrence of a name wins, like in the loaders.
+ */
+struct ref_opt {
+	char name[512];
+	char value[512];
+};
+
+static int ref_parse_line(const char *string, char delim, struct ref_opt *opt)
+{
+	char c;
+	int have_name = 0, have_quote = 0, i = 0;
+
+	while ((c = *string++) != '\0') {
+		if (c == '"') {
+			if (!have_name)
+				return -1;
+			if (have_quote && *string != '\n' && *string != '\0')
+				return -1;
+			have_quote = !have_quote;
+		} else if (c == ' ') {
+			if (have_quote)
+				opt->value[i++] = c;
+		} else if (c == delim) {
+			if (have_name)
+				return -1;
+			have_name = 1;
+			opt->name[i] = '\0';
+			i = 0;
+		} else if (c == '\n') {
+			break;
+		} else if (have_name) {
+			opt->value[i++] = c;
+		} else {
+			opt->name[i++] = c;
+		}
+	}
+	opt->value[i] = '\0';
+
+	return have_name && !have_quote ? 0 : -1;
+}
+
+/* @return: the number of distinct names, or -1 if the old parser fails */
+static int ref_load(const char *path, char delim, struct ref_opt *opts)
+{
+	struct ref_opt opt;
+	char line[1024];
+	FILE *fp;
+	int n = 0, i;
+
+	if (!(fp = fopen(path, "r")))
+		return -1;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (*line == '#' || *line == '\n')
+			continue;
+		if (ref_parse_line(line, delim, &opt) < 0) {
+			n = -1;
+			break;
+		}
+		for (i = 0; i < n && strcmp(opts[i].name, opt.name); i++)
+			;
+		if (i == n)
+			opts[n++] = opt;
+	}
+
+	fclose(fp);
+	return n;
+}
+
+static void put_token(FILE *fp, int maxlen, int spaces)
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789_.-/";
+	int len = rng() % (maxlen + 1), i;
+
+	for (i = 0; i < len; i++) {
+		if (spaces && !(rng() % 6))
+			fputc(' ', fp);
+		else
+			fputc(chars[rng() % (sizeof(chars) - 1)], fp);
+	}
+}
+
+static void put_spaces(FILE *fp)
+{
+	int n = (rng() % 3) ? 0 : rng() % 20;
+
+	while (n--)
+		fputc(' ', fp);
+}
+
+/* mostly valid lines, a few files with one bad line somewhere */
+static int gen_config(const char *path, char delim)
+{
+	static const char bad[][8] = { "x", "\"x", "a=b=c", "a=\"b", "a=\"b\"c" };
+	int lines = rng() % MAX_LINES, broken = !(rng() % 8), i;
+	FILE *fp;
+
+	if (!(fp = fopen(path, "w")))
+		return -1;
+
+	for (i = 0; i < lines; i++) {
+		switch (rng() % 16) {
+		case 0:
+			fputs("# comment\n", fp);
+			continue;
+		case 1:
+			fputc('\n', fp);
+			continue;
+		}
+
+		if (broken && i == lines / 2) {
+			fputs(bad[rng() % (sizeof(bad) / sizeof(bad[0]))], fp);
+			fputc('\n', fp);
+			continue;
+		}
+
+		put_spaces(fp);
+		fputc('k', fp);
+		put_token(fp, MAX_TOKEN / 2, 1);
+		put_spaces(fp);
+		fputc(delim, fp);
+		put_spaces(fp);
+		if (rng() % 3) {
+			put_token(fp, MAX_TOKEN, 0);
+			put_spaces(fp);
+		} else {
+			fputc('"', fp);
+			put_token(fp, MAX_TOKEN, 1);
+			fputc('"', fp);
+		}
+		/* the last line runs into the end of the file now and then */
+		if (i < lines - 1 || rng() % 2)
+			fputc('\n', fp);
+	}
+
+	return fclose(fp);
+}
+
+static int load_pieces(config_t *cfg, const char *path)
+{
+	config_parser_t *p;
+	static char buf[65536];
+	size_t len, off, n;
+	FILE *fp;
+	int ret = 0;
+
+	if (!(fp = fopen(path, "r")) || !(p = config_parser_open(cfg))) {
+		if (fp)
+			fclose(fp);
+		return -1;
+	}
+
+	len = fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+
+	for (off = 0; off < len && ret == 0; off += n) {
+		n = 1 + rng() % 40;
+		if (n > len - off)
+			n = len - off;
+		ret = config_parser_feed(p, buf + off, n);
+	}
+	/* finish frees the parser too */
+	if (ret < 0) {
+		config_parser_close(p);
+		return ret;
+	}
+
+	return config_parser_finish(p);
+}
+
+/* the keys of @cfg against the old parser's, and nothing more */
+static int compare_keys(config_t *cfg, struct ref_opt *opts, int n,
+						const char *save_path)
+{
+	char *value, line[2048];
+	FILE *fp;
+	int i, lines = 0, bad = 0;
+
+	for (i = 0; i < n; i++) {
+		if (!(value = cfg_get_value(cfg, opts[i].name)) ||
+			strcmp(value, opts[i].value))
+			bad++;
+	}
+
+	if (cfg_save(cfg, save_path) < 0 || !(fp = fopen(save_path, "r")))
+		return bad + 1;
+	while (fgets(line, sizeof(line), fp))
+		lines++;
+	fclose(fp);
+
+	return bad + (lines != n);
+}
+
+static int test_loaders(scan_fn_t fn, const char *name)
+{
+	static struct ref_opt opts[MAX_LINES];
+	char path[] = "/tmp/config-test-scan-XXXXXX";
+	char save_path[] = "/tmp/config-test-scan-save-XXXXXX";
+	config_t *cfg;
+	char delim;
+	int f, n, mode, ret, fd, bad = 0, failed = 0;
+
+	if ((fd = mkstemp(path)) < 0 || close(fd) < 0 ||
+		(fd = mkstemp(save_path)) < 0 || close(fd) < 0) {
+		perror("test_scan: temp files");
+		return 1;
+	}
+
+	scan_special = fn;
+	for (f = 0; f < NFILES; f++) {
+		delim = (f % 4) ? '=' : ':';
+		if (gen_config(path, delim) < 0) {
+			bad++;
+			break;
+		}
+		n = ref_load(path, delim, opts);
+		failed += n < 0;
+
+		for (mode = 0; mode < 3; mode++) {
+			cfg = config_open();
+			cfg_set_delim(cfg, delim);
+			if (mode == 0)
+				ret = cfg_load(cfg, path);
+			else if (mode == 1)
+				ret = cfg_load_mmap(cfg, path);
+			else
+				ret = load_pieces(cfg, path);
+
+			if ((ret < 0) != (n < 0) ||
+				(n >= 0 && compare_keys(cfg, opts, n, save_path))) {
+				if (bad++ < 10)
+					fprintf(stderr, "%s: file %d, loader %d differs\n", name, f, mode);
+			}
+			config_close(cfg);
+		}
+	}
+
+	unlink(path);
+	unlink(save_path);
+	printf("load %-6s %d files (%d rejected), %d bad\n", name, NFILES, failed, bad);
+	return bad;
+}
+
+int main(void)
+{
+	scan_fn_t fn, saved = scan_special;
+	size_t i;
+	int bad = 0;
+
+	for (i = 0; i < NR_IMPLS; i++) {
+		if (!(fn = scan_impl(impl_names[i]))) {
+			printf("scan %-6s not supported here, skipped\n", impl_names[i]);
+			continue;
+		}
+		bad += test_scanner(fn, impl_names[i]);
+		bad += test_loaders(fn, impl_names[i]);
+	}
+	scan_special = saved;
+
+	printf("test_scan: %s\n", bad ? "FAILED" : "ok");
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * cfg_load() and cfg_load_parallel() of the same file must put the same
+ * keys into the same sections, in the same order, and save the same
+ * lines.
+ *
+ * The generated file is several parallel chunks long and mixes the
+ * cases where the two loaders can disagree: a key repeated under its
+ * section, "sec.leaf" at the top level before and after "[sec] leaf",
+ * the same full name from "[a] b.c" and "[a.b] c", headers that come
+ * back later in the file, and " [k" keys that parsing in place moves
+ * to the start of their line.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#define NSECTIONS	40
+#define NLINES		400000
+#define NTHREADS	8
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+/* "s<n>" for most sections, "s<n>.x" nests in the one before it */
+static void section_name(char *buf, size_t size, int i)
+{
+	if (i % 5 == 4)
+		snprintf(buf, size, "s%d.x", i - 1);
+	else
+		snprintf(buf, size, "s%d", i);
+}
+
+static int gen_config(const char *path)
+{
+	char sec[32];
+	FILE *fp;
+	long i;
+	int cur = -1;
+
+	if (!(fp = fopen(path, "w")))
+		return -1;
+
+	for (i = 0; i < NLINES; i++) {
+		switch (rng() % 64) {
+		case 0:
+			cur = rng() % NSECTIONS;
+			section_name(sec, sizeof(sec), cur);
+			fprintf(fp, "[%s]\n", sec);
+			break;
+		case 1:
+			cur = -1;
+			fprintf(fp, "[]\n");
+			break;
+		case 2:
+			/* a full name at the top level, maybe sectioned elsewhere */
+			section_name(sec, sizeof(sec), rng() % NSECTIONS);
+			fprintf(fp, "%s%s.k%lu = top%ld\n", cur < 0 ? "" : "x.",
+					sec, (unsigned long)(rng() % 512), i);
+			break;
+		case 3:
+			/* "[s<n>] x.k" names the same key as "[s<n>.x] k" */
+			fprintf(fp, "x.k%lu = nested%ld\n", (unsigned long)(rng() % 512), i);
+			break;
+		case 4:
+			/* a key, not a header, even once it is parsed */
+			fprintf(fp, " [k%lu = spaced%ld\n", (unsigned long)(rng() % 512), i);
+			break;
+		default:
+			fprintf(fp, "k%lu = v%ld\n", (unsigned long)(rng() % 512), i);
+			break;
+		}
+	}
+
+	return fclose(fp);
+}
+
+static int compare_sections(config_t *a, config_t *b)
+{
+	config_section_iter_t ia, ib;
+	const char *na, *va, *nb, *vb;
+	char sec[32];
+	int i, ra, rb, bad = 0;
+	long keys = 0;
+
+	for (i = 0; i < NSECTIONS; i++) {
+		section_name(sec, sizeof(sec), i);
+		ra = cfg_section_iter(a, &ia, sec);
+		rb = cfg_section_iter(b, &ib, sec);
+		if (ra != rb) {
+			fprintf(stderr, "[%s]: iter %d serial, %d parallel\n", sec, ra, rb);
+			bad++;
+			continue;
+		}
+		if (ra < 0)
+			continue;
+
+		for (;;) {
+			ra = config_section_next(&ia, &na, &va);
+			rb = config_section_next(&ib, &nb, &vb);
+			if (ra != rb) {
+				fprintf(stderr, "[%s]: ends after %s in the %s load\n", sec,
+						ra ? "fewer keys" : "more keys", ra ? "parallel" : "serial");
+				bad++;
+				break;
+			}
+			if (!ra)
+				break;
+			if (strcmp(na, nb) || strcmp(va, vb)) {
+				fprintf(stderr, "[%s]: %s = %s serial, %s = %s parallel\n",
+						sec, na, va, nb, vb);
+				bad++;
+				break;
+			}
+			keys++;
+		}
+	}
+
+	printf("%ld sectioned keys compared\n", keys);
+	return bad;
+}
+
+static int cmp_line(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* the lines of @path sorted, top level keys are saved in table order */
+static char **read_lines(const char *path, size_t *n, char **buf)
+{
+	FILE *fp;
+	char **lines = NULL, *p;
+	long len;
+	size_t cap = 0;
+
+	*n = 0;
+	if (!(fp = fopen(path, "r")))
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	rewind(fp);
+	*buf = malloc(len + 1);
+	if (!*buf || fread(*buf, 1, len, fp) != (size_t)len) {
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+	(*buf)[len] = '\0';
+
+	for (p = strtok(*buf, "\n"); p; p = strtok(NULL, "\n")) {
+		if (*n == cap) {
+			cap = cap ? cap * 2 : 1024;
+			lines = realloc(lines, sizeof(char *) * cap);
+		}
+		lines[(*n)++] = p;
+	}
+	qsort(lines, *n, sizeof(char *), cmp_line);
+
+	return lines;
+}
+
+static int compare_saves(const char *p1, const char *p2)
+{
+	char **l1, **l2, *b1 = NULL, *b2 = NULL;
+	size_t n1, n2, i;
+	int ret = -1;
+
+	l1 = read_lines(p1, &n1, &b1);
+	l2 = read_lines(p2, &n2, &b2);
+	if (l1 && l2 && n1 == n2) {
+		for (i = 0; i < n1 && !strcmp(l1[i], l2[i]); i++)
+			;
+		ret = i == n1 ? 0 : -1;
+	}
+
+	free(l1);
+	free(l2);
+	free(b1);
+	free(b2);
+	return ret;
+}
+
+int main(void)
+{
+	char path[] = "/tmp/config-test-sections-XXXXXX";
+	char save_a[] = "/tmp/config-test-save-a-XXXXXX";
+	char save_b[] = "/tmp/config-test-save-b-XXXXXX";
+	config_t *a, *b;
+	int fd, bad = 0;
+
+	if ((fd = mkstemp(path)) < 0 || close(fd) < 0 || gen_config(path) < 0) {
+		perror("test_sections: generating config");
+		return 1;
+	}
+	if ((fd = mkstemp(save_a)) >= 0)
+		close(fd);
+	if ((fd = mkstemp(save_b)) >= 0)
+		close(fd);
+
+	a = config_open();
+	b = config_open();
+	if (cfg_load(a, path) < 0 || cfg_load_parallel(b, path, NTHREADS) < 0) {
+		fprintf(stderr, "test_sections: cannot load %s\n", path);
+		bad++;
+		goto out;
+	}
+
+	bad += compare_sections(a, b);
+
+	if (cfg_save(a, save_a) < 0 || cfg_save(b, save_b) < 0 ||
+		compare_saves(save_a, save_b) < 0) {
+		fprintf(stderr, "test_sections: saves differ\n");
+		bad++;
+	}
+
+out:
+	config_close(a);
+	config_close(b);
+	unlink(path);
+	unlink(save_a);
+	unlink(save_b);
+
+	printf("test_sections: %s\n", bad ? "FAILED" : "ok");
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "watch.h"
+#include "debug.h"
+
+#define WATCH_EVENTS	(IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE | \
+						 IN_DELETE | IN_ATTRIB)
+
+static void hash_word(struct watch_hash *h, uint64_t w)
+{
+	h->hash = (h->hash ^ w) * 0x100000001b3ULL;
+	h->hash ^= h->hash >> 29;
+}
+
+void watch_hash_init(struct watch_hash *h)
+{
+	h->hash = 0x9e3779b97f4a7c15ULL;
+	h->len = 0;
+	h->tail = 0;
+}
+
+/* word at a time, however the data is split up */
+void watch_hash_update(struct watch_hash *h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t used = h->len % 8, n;
+	uint64_t w;
+
+	if (!len)
+		return;
+	h->len += len;
+
+	if (used) {
+		n = len < 8 - used ? len : 8 - used;
+		memcpy((unsigned char *)&h->tail + used, p, n);
+		if (used + n < 8)
+			return;
+		hash_word(h, h->tail);
+		h->tail = 0;
+		p += n;
+		len -= n;
+	}
+
+	for (; len >= 8; p += 8, len -= 8) {
+		memcpy(&w, p, 8);
+		hash_word(h, w);
+	}
+	memcpy(&h->tail, p, len);
+}
+
+/* the tail is padded with zeroes */
+uint64_t watch_hash_final(struct watch_hash *h)
+{
+	if (h->len % 8)
+		hash_word(h, h->tail);
+	hash_word(h, h->len);
+
+	return h->hash;
+}
+
+/* a missing or unreadable file sets *err and hashes as 0 */
+uint64_t watch_file_hash(const char *path, int *err)
+{
+	int fd;
+	struct stat st;
+	void *map;
+	struct watch_hash h;
+
+	*err = 0;
+	watch_hash_init(&h);
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		if (fd >= 0)
+			close(fd);
+		*err = 1;
+		return 0;
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		return watch_hash_final(&h);
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		*err = 1;
+		return 0;
+	}
+
+	watch_hash_update(&h, map, st.st_size);
+	munmap(map, st.st_size);
+
+	return watch_hash_final(&h);
+}
+
+static int epoll_add(int epfd, int fd)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* (re)start the quiet period */
+static void arm_timer(struct watch *w)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = w->debounce_ms / 1000;
+	its.it_value.tv_nsec = (w->debounce_ms % 1000) * 1000000L;
+	if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+		its.it_value.tv_nsec = 1;
+
+	timerfd_settime(w->timerfd, 0, &its, NULL);
+}
+
+/*
+ * Start watching the directory of @path, then drop the one watched so
+ * far unless it is the same. Nothing changes if that fails.
+ */
+static int watch_path(struct watch *w, const char *path)
+{
+	char *dup, *dir = NULL, *name = NULL, *tmp;
+	int wd;
+
+	if (!(dup = strdup(path)))
+		return -1;
+	if ((tmp = strdup(path))) {
+		dir = strdup(dirname(tmp));
+		free(tmp);
+	}
+	if ((tmp = strdup(path))) {
+		name = strdup(basename(tmp));
+		free(tmp);
+	}
+	if (!dir || !name)
+		goto fail;
+
+	if ((wd = inotify_add_watch(w->infd, dir, WATCH_EVENTS)) < 0) {
+		debug("inotify_add_watch %s: %s", dir, strerror(errno));
+		goto fail;
+	}
+	if (w->wd >= 0 && w->wd != wd)
+		inotify_rm_watch(w->infd, w->wd);
+	w->wd = wd;
+
+	free(w->path);
+	free(w->dir);
+	free(w->name);
+	w->path = dup;
+	w->dir = dir;
+	w->name = name;
+	return 0;
+
+fail:
+	free(dup);
+	free(dir);
+	free(name);
+	return -1;
+}
+
+/*
+ * Watch @path, whose content hashed to @hash when it was loaded: see
+ * watch_hash_init(). Changes are reported relative to that.
+ */
+struct watch *watch_open(const char *path, uint64_t hash, int debounce_ms)
+{
+	struct watch *w;
+
+	if (!(w = calloc(1, sizeof(struct watch))))
+		return NULL;
+
+	w->epfd = w->infd = w->timerfd = w->wakefd = w->wd = -1;
+	w->debounce_ms = debounce_ms;
+	w->hash = hash;
+
+	if ((w->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+		(w->infd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+		(w->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+		(w->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+		goto fail;
+
+	if (watch_path(w, path) < 0)
+		goto fail;
+
+	if (epoll_add(w->epfd, w->infd) < 0 ||
+		epoll_add(w->epfd, w->timerfd) < 0 ||
+		epoll_add(w->epfd, w->wakefd) < 0)
+		goto fail;
+
+	/* it may have changed since it was loaded, look once right away */
+	arm_timer(w);
+
+	return w;
+
+fail:
+	watch_close(w);
+	return NULL;
+}
+
+/*
+ * Follow a load of another file, or a new load of this one: watch @path
+ * if it is not the file watched already, and report changes relative to
+ * @hash from now on. @return: -1 if @path can not be watched, the old
+ * file still is then.
+ */
+int watch_set_file(struct watch *w, const char *path, uint64_t hash)
+{
+	if (strcmp(path, w->path)) {
+		if (watch_path(w, path) < 0)
+			return -1;
+		arm_timer(w);
+	}
+
+	w->hash = hash;
+	return 0;
+}
+
+/* @return: 1 if an event concerned the watched file */
+static int drain_inotify(struct watch *w)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t len;
+	char *p;
+	int hit = 0;
+
+	while ((len = read(w->infd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			/* a directory watched before watch_set_file() is not it */
+			if (ev->wd == w->wd && ev->len && strcmp(ev->name, w->name) == 0)
+				hit = 1;
+		}
+	}
+
+	return hit;
+}
+
+/*
+ * Handle whatever is pending on watch_fd(), waiting up to @timeout_ms
+ * (-1 forever, 0 not at all) for something to happen.
+ *
+ * @return: 1 once a burst of events has settled and the file content is
+ *          different from the hash of watch_open() or watch_set_file(),
+ *          0 otherwise. The hash is not updated: the caller knows what it
+ *          managed to load and sets it with watch_set_file().
+ */
+int watch_dispatch(struct watch *w, int timeout_ms)
+{
+	struct epoll_event evs[3];
+	uint64_t ticks, hash;
+	int i, n, err, fired = 0;
+
+	if ((n = epoll_wait(w->epfd, evs, 3, timeout_ms)) < 0)
+		return errno == EINTR ? 0 : -1;
+
+	for (i = 0; i < n; i++) {
+		if (evs[i].data.fd == w->infd) {
+			if (drain_inotify(w))
+				arm_timer(w);
+		} else if (evs[i].data.fd == w->timerfd) {
+			if (read(w->timerfd, &ticks, sizeof(ticks)) == sizeof(ticks))
+				fired = 1;
+		} else if (evs[i].data.fd == w->wakefd) {
+			if (read(w->wakefd, &ticks, sizeof(ticks)) < 0)
+				debug("eventfd read: %s", strerror(errno));
+		}
+	}
+
+	if (!fired)
+		return 0;
+
+	/* gone for now (mid rename), wait for it to come back */
+	hash = watch_file_hash(w->path, &err);
+	if (err || hash == w->hash)
+		return 0;
+
+	return 1;
+}
+
+/* make a blocking watch_dispatch() return */
+void watch_wakeup(struct watch *w)
+{
+	uint64_t one = 1;
+
+	if (write(w->wakefd, &one, sizeof(one)) < 0)
+		debug("eventfd write: %s", strerror(errno));
+}
+
+void watch_close(struct watch *w)
+{
+	if (!w)
+		return;
+
+	if (w->epfd >= 0)
+		close(w->epfd);
+	if (w->infd >= 0)
+		close(w->infd);
+	if (w->timerfd >= 0)
+		close(w->timerfd);
+	if (w->wakefd >= 0)
+		close(w->wakefd);
+
+	free(w->dir);
+	free(w->name);
+	free(w->path);
+	free(w);
+}
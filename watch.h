@@ -0,0 +1,51 @@
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* quiet time after the last event before the file is looked at */
+#define WATCH_DEBOUNCE_MS	100
+
+/*
+ * Watches one file for writes and for being replaced by a rename. The
+ * parent directory is watched, so editors and atomic savers that rename
+ * a new file over the old one are seen as well.
+ */
+struct watch {
+	int epfd;			/* what callers poll, it covers the fds below */
+	int infd;			/* inotify */
+	int timerfd;		/* debounce timer */
+	int wakefd;			/* eventfd for watch_wakeup() */
+	int debounce_ms;
+	int wd;				/* inotify watch of dir */
+	char *dir;
+	char *name;
+	char *path;
+	uint64_t hash;		/* content hash of what was loaded */
+};
+
+/* content hash of a file fed in pieces of any size, what the watch compares */
+struct watch_hash {
+	uint64_t hash;
+	uint64_t len;
+	uint64_t tail;		/* the bytes after the last whole word */
+};
+
+void watch_hash_init(struct watch_hash *h);
+void watch_hash_update(struct watch_hash *h, const void *data, size_t len);
+uint64_t watch_hash_final(struct watch_hash *h);
+
+struct watch *watch_open(const char *path, uint64_t hash, int debounce_ms);
+int watch_set_file(struct watch *w, const char *path, uint64_t hash);
+/* @return: a pollable fd that turns readable when watch_dispatch() has work */
+static inline int watch_fd(const struct watch *w)
+{
+	return w->epfd;
+}
+int watch_dispatch(struct watch *w, int timeout_ms);
+void watch_wakeup(struct watch *w);
+void watch_close(struct watch *w);
+uint64_t watch_file_hash(const char *path, int *err);
+
+#endif /* _WATCH_H_ */